@@ -0,0 +1,149 @@
+// What the advertising schedule trades: advertising events, which is where a
+// parked, disconnected Duo spends its radio current, against how long a phone
+// that starts looking at some point waits for the next advertisement. Runs the
+// firmware's bluetooth task on the simulated clock for an hour after boot, next
+// to the fixed 30 ms interval the firmware used before, then wakes the car with
+// a power mode frame through the controller, its filters and processCAN().
+//
+//   advertising_simulation [minutes]
+//
+// A phone scanning continuously connects on the first advertising event it
+// sees. Advertising events are the interval plus the 0-10 ms random delay the
+// spec adds to each. The current estimate assumes CHARGE_PER_EVENT for an event
+// on all three channels with a scan response; measure it on the board to calibrate.
+
+#include "Mock.h"
+#include "CANReceiver.h"
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace {
+    const uint32_t powerModeId = 0x1F1;
+    // microcoulombs
+    const double CHARGE_PER_EVENT = 15;
+    // how often the schedule is stepped, loop() runs at least this often disconnected
+    const uint32_t STEP = 10;
+
+    struct Result {
+        // ms since the disconnect
+        std::vector<uint64_t> events;
+
+        // from a phone starting to look at `at` to the next event, ms
+        uint64_t waitFrom(uint64_t at) const {
+            for (uint64_t event : events) {
+                if (event >= at)
+                    return event - at;
+            }
+            return 0;
+        }
+    };
+
+    // advertising events over `duration` ms, at whatever interval (0.625 ms
+    // units) `interval` returns as the simulated clock advances. a change of
+    // interval restarts advertising, as stop and start do in btstack
+    Result simulate(uint64_t duration, std::function<uint16_t(uint64_t)> interval) {
+        Result result;
+        uint32_t seed = 1;
+        uint16_t current = interval(0);
+        uint64_t next = 0;
+        for (uint64_t now = 0; now < duration; now += 1) {
+            if (now % STEP == 0) {
+                uint16_t changed = interval(now);
+                if (changed != current) {
+                    current = changed;
+                    next = now;
+                }
+            }
+            if (now >= next) {
+                result.events.push_back(now);
+                seed = seed * 1103515245 + 12345;
+                next = now + current * 625 / 1000 + (seed >> 16) % 11;
+            }
+            Mock::advanceMillis(1);
+        }
+        return result;
+    }
+
+    void report(const char* name, const Result& result, uint64_t duration) {
+        // reconnect waits for phones starting to look every second, per phase of the schedule
+        struct Phase {
+            const char* name;
+            uint64_t from, to;
+        };
+        const Phase phases[] = {
+            { "first 30 s", 0, 30000 },
+            { "to 2 min", 30000, 120000 },
+            { "after", 120000, duration },
+        };
+
+        double hours = duration / 3600000.0;
+        double perHour = result.events.size() / hours;
+        printf("%-14s %8.0f events/h  %6.1f uA", name, perHour, perHour * CHARGE_PER_EVENT / 3600);
+        for (const Phase& phase : phases) {
+            uint64_t total = 0;
+            uint64_t worst = 0;
+            size_t count = 0;
+            for (uint64_t at = phase.from + 500; at < phase.to; at += 1000) {
+                uint64_t wait = result.waitFrom(at);
+                total += wait;
+                worst = wait > worst ? wait : worst;
+                count++;
+            }
+            printf("  %s: %4llu/%4llu ms", phase.name,
+                (unsigned long long)(count ? total / count : 0), (unsigned long long)worst);
+        }
+        printf("\n");
+    }
+}
+
+extern CANChannel can;
+extern CANReceiver receiver;
+void processCAN();
+void processBluetooth();
+
+int main(int argc, char** argv) {
+    uint64_t duration = (argc > 1 ? strtoull(argv[1], nullptr, 10) : 60) * 60000;
+
+    Serial.capture = false;
+    printf("reconnect waits as mean/worst, current at %.0f uC per event\n", CHARGE_PER_EVENT);
+
+    Result fixed = simulate(duration, [](uint64_t) -> uint16_t { return 48; });
+    report("fixed 30 ms", fixed, duration);
+
+    // the firmware from boot, its bluetooth task steps the schedule
+    setup();
+    Result scheduled = simulate(duration, [&](uint64_t) {
+        processBluetooth();
+        return ble.advertisingParameters.adv_int_min;
+    });
+    report("schedule", scheduled, duration);
+
+    // parked for the whole run, then the ignition brings the bus back. the power
+    // mode frame has to get past the filters and be handed to processCAN(); the
+    // driver's phone looks a few seconds later
+    CANMessage powerMode;
+    powerMode.id = powerModeId;
+    powerMode.len = 8;
+    bool accepted = can.inject(powerMode);
+    // the receive thread takes it off the controller once the clock moves on
+    for (int i = 0; i < 100 && receiver.pending() == 0; i++) {
+        Mock::advanceMillis(1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    processCAN();
+    Result woken = simulate(10000, [&](uint64_t) {
+        processBluetooth();
+        return ble.advertisingParameters.adv_int_min;
+    });
+    printf("woken by CAN: phone looking 3 s later waits %llu ms\n", (unsigned long long)woken.waitFrom(3000));
+
+    bool ok = scheduled.events.size() < fixed.events.size() && accepted && woken.waitFrom(3000) < 40;
+    if (!ok)
+        printf("FAILED: the schedule should advertise less, and fast again once the car wakes\n");
+    fflush(stdout);
+    // the receive thread never stops, skip static destructors it could still be using
+    std::_Exit(ok ? 0 : 1);
+}
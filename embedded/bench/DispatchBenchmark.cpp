@@ -0,0 +1,87 @@
+// Cost of CANDispatcher::dispatch with 1, 16 and 128 exact-id handlers, next
+// to the chain of id comparisons it replaced. Half the frames have a handler,
+// as when the SLCAN bridge or the stream has the filters opened up.
+//
+//   dispatch_benchmark [frames]
+
+#include "CANDispatcher.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+    volatile uint32_t handled = 0;
+
+    void handler(const CANFrame& frame) {
+        handled++;
+    }
+
+    // ids of a real bus are clustered, with gaps
+    uint32_t idFor(size_t index) {
+        return 0x100 + index * 5;
+    }
+
+    // what loop() did before: one comparison per handled id
+    struct Chain {
+        std::vector<uint32_t> ids;
+
+        bool dispatch(const CANFrame& frame) const {
+            for (uint32_t id : ids) {
+                if (frame.message.id == id && !frame.message.extended) {
+                    handler(frame);
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+
+    template <typename Dispatch>
+    double nanosecondsPerFrame(const std::vector<CANFrame>& frames, size_t count, Dispatch dispatch) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < count; i++)
+            dispatch(frames[i % frames.size()]);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        return std::chrono::duration<double, std::nano>(elapsed).count() / count;
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10000000;
+    bool ok = true;
+
+    printf("handlers  dispatcher ns/frame  chain ns/frame\n");
+    for (size_t handlers : { 1, 16, 128 }) {
+        CANDispatcher dispatcher;
+        Chain chain;
+        for (size_t i = 0; i < handlers; i++) {
+            ok = dispatcher.on(idFor(i), handler) && ok;
+            chain.ids.push_back(idFor(i));
+        }
+
+        // every registered id once, and as many ids nobody handles
+        std::vector<CANFrame> frames;
+        for (size_t i = 0; i < handlers; i++) {
+            CANFrame hit;
+            hit.message.id = idFor(i);
+            frames.push_back(hit);
+            CANFrame miss;
+            miss.message.id = idFor(i) + 1;
+            frames.push_back(miss);
+        }
+
+        handled = 0;
+        double dispatcherCost = nanosecondsPerFrame(frames, count, [&](const CANFrame& frame) { dispatcher.dispatch(frame); });
+        ok = ok && handled == (count + 1) / 2;
+        handled = 0;
+        double chainCost = nanosecondsPerFrame(frames, count, [&](const CANFrame& frame) { chain.dispatch(frame); });
+        ok = ok && handled == (count + 1) / 2;
+
+        printf("%8zu  %19.1f  %14.1f\n", handlers, dispatcherCost, chainCost);
+    }
+
+    if (!ok)
+        printf("FAILED: handlers missing or called the wrong number of times\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,126 @@
+// Cost of finding the attribute behind an ATT handle in the read callback:
+// the two std::maps Manager used to search, next to the handle-indexed table
+// it keeps now. A few reads hit handles nothing is registered for, as when a
+// client walks the attribute table.
+//
+//   handle_lookup_benchmark [reads]
+
+#include "BLE.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <vector>
+
+using namespace BLE;
+
+namespace {
+    const uint8_t initial[4] = { 1, 2, 3, 4 };
+
+    // what the read callback did before, operator[] and all
+    struct Maps {
+        std::map<uint16_t, std::shared_ptr<Characteristic>> characteristicHandles;
+        std::map<uint16_t, std::shared_ptr<Descriptor>> descriptorHandles;
+
+        uint16_t read(uint16_t handle, uint8_t* buffer, uint16_t bufferSize) {
+            std::shared_ptr<Characteristic> characteristic = characteristicHandles[handle];
+            if (characteristic) {
+                Bytes value = characteristic->getValue();
+                memcpy(buffer, value.data, value.size < bufferSize ? value.size : bufferSize);
+                return value.size;
+            }
+            std::shared_ptr<Descriptor> descriptor = descriptorHandles[handle];
+            if (descriptor) {
+                Bytes value = descriptor->getValue();
+                memcpy(buffer, value.data, value.size < bufferSize ? value.size : bufferSize);
+                return value.size;
+            }
+            return 0;
+        }
+    };
+
+    // what it does now, see Manager::attributeFor
+    struct Table {
+        struct Attribute {
+            Characteristic* characteristic = nullptr;
+            Descriptor* descriptor = nullptr;
+        };
+        Attribute attributes[Manager::MAX_HANDLES];
+
+        uint16_t read(uint16_t handle, uint8_t* buffer, uint16_t bufferSize) const {
+            Attribute attribute = handle < Manager::MAX_HANDLES ? attributes[handle] : Attribute();
+            if (Characteristic* characteristic = attribute.characteristic) {
+                Bytes value = characteristic->getValue();
+                memcpy(buffer, value.data, value.size < bufferSize ? value.size : bufferSize);
+                return value.size;
+            }
+            if (Descriptor* descriptor = attribute.descriptor) {
+                Bytes value = descriptor->getValue();
+                memcpy(buffer, value.data, value.size < bufferSize ? value.size : bufferSize);
+                return value.size;
+            }
+            return 0;
+        }
+    };
+
+    template <typename Read>
+    double nanosecondsPerRead(const std::vector<uint16_t>& handles, size_t count, Read read) {
+        uint8_t buffer[20];
+        size_t bytes = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < count; i++)
+            bytes += read(handles[i % handles.size()], buffer, sizeof(buffer));
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        // keep the reads from being optimized away
+        if (bytes == 0)
+            printf("no bytes read\n");
+        return std::chrono::duration<double, std::nano>(elapsed).count() / count;
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10000000;
+
+    // laid out like the firmware's table: declaration, value, then the client
+    // configuration descriptor of the characteristics that indicate
+    Maps maps;
+    Table table;
+    std::vector<std::shared_ptr<Characteristic>> characteristics;
+    std::vector<uint16_t> handles;
+    uint16_t handle = 1;
+    for (uint16_t i = 0; i < 12; i++) {
+        std::shared_ptr<Characteristic> characteristic;
+        if (i % 2)
+            characteristic = std::make_shared<IndicateCharacteristic<4>>(UUID(0x2A00 + i), Bytes(initial, sizeof(initial)));
+        else
+            characteristic = std::make_shared<MutableCharacteristic<4>>(UUID(0x2A00 + i), Bytes(initial, sizeof(initial)));
+        characteristics.push_back(characteristic);
+
+        uint16_t valueHandle = handle + 1;
+        maps.characteristicHandles[valueHandle] = characteristic;
+        table.attributes[valueHandle].characteristic = characteristic.get();
+        handles.push_back(valueHandle);
+        handle += 2;
+
+        if (i % 2) {
+            std::shared_ptr<Descriptor> descriptor = std::make_shared<MutableDescriptor<2>>(UUID(0x2902), Bytes(initial, 2));
+            maps.descriptorHandles[handle] = descriptor;
+            table.attributes[handle].descriptor = descriptor.get();
+            handles.push_back(handle);
+            handle++;
+        }
+    }
+    // one read in eight is for a handle nothing is registered for
+    size_t registered = handles.size();
+    for (size_t i = 0; i < registered / 7; i++)
+        handles.push_back(handle + i * 3);
+
+    size_t mapSize = maps.characteristicHandles.size() + maps.descriptorHandles.size();
+    double mapCost = nanosecondsPerRead(handles, count, [&](uint16_t handle, uint8_t* buffer, uint16_t size) { return maps.read(handle, buffer, size); });
+    double tableCost = nanosecondsPerRead(handles, count, [&](uint16_t handle, uint8_t* buffer, uint16_t size) { return table.read(handle, buffer, size); });
+    size_t grownSize = maps.characteristicHandles.size() + maps.descriptorHandles.size();
+
+    printf("maps:  %5.1f ns/read, %zu entries grew to %zu\n", mapCost, mapSize, grownSize);
+    printf("table: %5.1f ns/read, %zu bytes, never grows\n", tableCost, sizeof(table.attributes));
+    return 0;
+}
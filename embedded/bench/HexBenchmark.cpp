@@ -0,0 +1,91 @@
+// Cost of decoding what an SLCAN transmit command carries, an 8 digit id and
+// 8 data bytes: the shared table-driven Hex codec, next to the branching
+// parseHex/hex2int SLCAN had before.
+//
+//   hex_benchmark [commands]
+
+#include "Hex.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+    // what SLCAN did before
+    unsigned hex2int(char c) {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        else if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+
+        return 0xff;
+    }
+
+    bool parseHex(const char *buf, unsigned digits, uint32_t& value) {
+        value = 0;
+        for (unsigned i = 0; i < digits; i++) {
+            unsigned digit = hex2int(buf[i]);
+            if (digit > 0xf)
+                return false;
+            value = (value << 4) | digit;
+        }
+        return true;
+    }
+
+    bool oldDecode(const char *in, uint32_t& id, uint8_t *data) {
+        if (!parseHex(in, 8, id))
+            return false;
+        for (unsigned i = 0; i < 8; i++, in += 2) {
+            uint32_t byte;
+            if (!parseHex(in + 8, 2, byte))
+                return false;
+            data[i] = byte;
+        }
+        return true;
+    }
+
+    bool newDecode(const char *in, uint32_t& id, uint8_t *data) {
+        return Hex::decode(in, 8, id) && Hex::decodeBytes(in + 8, data, 8);
+    }
+
+    const size_t commandLength = 24;
+
+    template <typename Decode>
+    double nanosecondsPerCommand(const std::vector<char>& commands, size_t count, Decode decode) {
+        size_t commandCount = commands.size() / commandLength;
+        uint32_t checksum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < count; i++) {
+            uint32_t id;
+            uint8_t data[8];
+            if (decode(&commands[(i % commandCount) * commandLength], id, data))
+                checksum += id + data[7];
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        // keep the decoding from being optimized away
+        if (checksum == 0)
+            printf("nothing decoded\n");
+        return std::chrono::duration<double, std::nano>(elapsed).count() / count;
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10000000;
+
+    // mixed case like different hosts send, all valid
+    std::vector<char> commands;
+    const char digits[] = "0123456789abcdefABCDEF";
+    unsigned seed = 1;
+    for (size_t i = 0; i < 256 * commandLength; i++) {
+        seed = seed * 1103515245 + 12345;
+        commands.push_back(digits[(seed >> 16) % (sizeof(digits) - 1)]);
+    }
+
+    double oldCost = nanosecondsPerCommand(commands, count, oldDecode);
+    double newCost = nanosecondsPerCommand(commands, count, newDecode);
+    printf("parseHex: %5.1f ns per id and 8 bytes\n", oldCost);
+    printf("Hex:      %5.1f ns per id and 8 bytes\n", newCost);
+    return 0;
+}
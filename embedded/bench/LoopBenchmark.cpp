@@ -0,0 +1,141 @@
+// Drives synthetic GMLAN traffic through the firmware's setup() and loop(),
+// with the real receive thread and the host's clock, and reports what the
+// phone would see:
+//   throughput: steering wheel frames flooded in, indications out per second
+//   latency: paced frames, from arriving at the controller to the indication
+//   allocations: heap allocations per frame on both threads
+//
+//   loop_benchmark [frames] [interval us]
+// exits non-zero if any steering wheel frame doesn't reach the phone.
+
+#include "Mock.h"
+#include "BLE.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+namespace {
+    constexpr BLE::UUID steeringWheelCharacteristicUUID("BBBEF1D2-E1E6-4189-BE0B-C00D6D3CC6BB");
+    const uint32_t steeringWheelId = 0x290;
+    // other traffic the acceptance filters should keep out, per steering wheel frame
+    const int noisePerFrame = 3;
+    const uint32_t timeout = 10 * 1000 * 1000;
+
+    // alternating press and release, every frame is an edge and is indicated
+    CANMessage steeringWheelFrame(size_t index) {
+        CANMessage message;
+        message.id = steeringWheelId;
+        message.len = 4;
+        message.data[3] = (index & 1) ? 0x00 : 0x10;
+        return message;
+    }
+
+    CANMessage noiseFrame(size_t index) {
+        CANMessage message;
+        message.id = 0x100 + (index % 0x80);
+        message.len = 8;
+        return message;
+    }
+
+    // the controller's receive queue, CANChannel's default
+    const uint8_t controllerQueueSize = 32;
+
+    void inject(CANChannel& can, const CANMessage& message) {
+        // a real bus doesn't wait, but the point is to measure the firmware, not
+        // how quickly the producer overruns the controller
+        while (can.accepts(message) && can.available() >= controllerQueueSize)
+            std::this_thread::yield();
+        can.inject(message);
+    }
+
+    // runs loop() until count more indications went out, false on timeout
+    bool runUntil(size_t count) {
+        uint64_t start = Mock::now();
+        while (ble.updates.size() < count) {
+            loop();
+            if (Mock::now() - start > timeout)
+                return false;
+        }
+        return true;
+    }
+
+    uint32_t percentile(std::vector<uint32_t> values, double fraction) {
+        std::sort(values.begin(), values.end());
+        return values[(size_t)(fraction * (values.size() - 1))];
+    }
+}
+
+extern CANChannel can;
+
+int main(int argc, char** argv) {
+    size_t frames = argc > 1 ? strtoul(argv[1], nullptr, 10) : 100000;
+    uint32_t interval = argc > 2 ? strtoul(argv[2], nullptr, 10) : 1000;
+
+    Mock::useRealClock(true);
+    Serial.capture = false;
+    setup();
+
+    // the phone connects and asks for button presses
+    ble.connect();
+    ble.write(ble.configurationHandle(steeringWheelCharacteristicUUID.data128()),
+        { GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_INDICATION, 0 });
+    // let the connection settle, a pass can idle until the next timed task
+    uint64_t settled = Mock::now() + 300 * 1000;
+    while (Mock::now() < settled)
+        loop();
+    uint16_t handle = ble.valueHandle(steeringWheelCharacteristicUUID.data128());
+
+    // throughput, everything at once
+    ble.updates.clear();
+    ble.updates.reserve(frames * 2);
+    uint64_t allocations = Mock::allocations();
+    uint64_t start = Mock::now();
+    std::thread producer([&]() {
+        for (size_t i = 0; i < frames; i++) {
+            inject(can, steeringWheelFrame(i));
+            for (int j = 0; j < noisePerFrame; j++)
+                inject(can, noiseFrame(i * noisePerFrame + j));
+        }
+    });
+    bool delivered = runUntil(frames);
+    // up to the last indication, the pass that sent it may idle afterwards
+    uint32_t elapsed = (delivered ? ble.updates[frames - 1].time : micros()) - (uint32_t)start;
+    producer.join();
+    allocations = Mock::allocations() - allocations;
+
+    printf("throughput: %zu frames in %.1f ms, %.0f frames/s, %.3f allocations/frame\n",
+        frames, elapsed / 1000.0, frames * 1e6 / elapsed, (double)allocations / frames);
+
+    // latency, one frame at a time
+    size_t paced = frames < 2000 ? frames : 2000;
+    std::vector<uint32_t> arrived(paced);
+    std::vector<uint32_t> latencies;
+    ble.updates.clear();
+    std::thread pacer([&]() {
+        for (size_t i = 0; i < paced; i++) {
+            arrived[i] = micros();
+            inject(can, steeringWheelFrame(i));
+            std::this_thread::sleep_for(std::chrono::microseconds(interval));
+        }
+    });
+    delivered = runUntil(paced) && delivered;
+    pacer.join();
+
+    for (size_t i = 0; i < paced && i < ble.updates.size(); i++) {
+        if (ble.updates[i].handle == handle)
+            latencies.push_back(ble.updates[i].time - arrived[i]);
+    }
+    if (!latencies.empty()) {
+        printf("latency: %zu frames every %u us, median %u us, p99 %u us, max %u us\n",
+            latencies.size(), interval, percentile(latencies, 0.5), percentile(latencies, 0.99),
+            percentile(latencies, 1.0));
+    }
+    printf("filtered by the controller: %u, controller overflows: %u\n", can.filtered, can.overflows);
+
+    if (!delivered || latencies.size() != paced)
+        printf("FAILED: not every frame was indicated\n");
+    fflush(stdout);
+    // the receive thread never stops, skip static destructors it could still be using
+    std::_Exit(delivered && latencies.size() == paced ? 0 : 1);
+}
@@ -0,0 +1,126 @@
+// Cost of rendering received frames for the SLCAN host: the batch encoder in
+// SLCAN::printReceivedMessages in text and in binary (B1) mode, next to the
+// printf per field it replaced. All write to a USB serial port that throws the
+// bytes away, after checking on a few frames that the text encoder and printf
+// produce the same text and that binary mode sends one packet per frame.
+//
+// The device's Serial path is bound by USB full speed as well: bulk transfers
+// carry at most 19 packets of 64 bytes per 1 ms frame, so the frames/s each
+// mode could sustain on the link are given from its bytes per frame.
+//
+//   slcan_benchmark [frames]
+
+#include "Mock.h"
+#include "SLCAN.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+    // what printReceivedMessage did before, one frame at a time
+    void printfMessage(USBSerial& serial, const CANFrame& frame) {
+        const CANMessage& message = frame.message;
+        if (message.extended)
+            serial.printf(message.rtr ? "R%08lx%d" : "T%08lx%d", (unsigned long)message.id, message.len);
+        else
+            serial.printf(message.rtr ? "r%03lx%d" : "t%03lx%d", (unsigned long)message.id, message.len);
+        if (!message.rtr) {
+            for (auto i = 0; i < message.len; i++) {
+                serial.printf("%02x", message.data[i]);
+            }
+        }
+        // lawicel timestamps are milliseconds wrapping every minute
+        serial.printf("%04x", (unsigned)((frame.timestamp / 1000) % 60000));
+        serial.write('\r');
+    }
+
+    // a bit of everything, mostly standard data frames like GMLAN
+    std::vector<CANFrame> makeFrames(size_t count) {
+        std::vector<CANFrame> frames(count);
+        for (size_t i = 0; i < count; i++) {
+            CANMessage& message = frames[i].message;
+            message.extended = i % 8 == 7;
+            message.rtr = i % 32 == 31;
+            message.id = message.extended ? 0x10000000 + i * 7919 : 0x100 + (i * 13) % 0x700;
+            message.len = i % 9;
+            for (uint8_t j = 0; j < message.len; j++)
+                message.data[j] = i * 31 + j;
+            frames[i].timestamp = i * 250;
+            frames[i].milliseconds = i / 4;
+        }
+        return frames;
+    }
+
+    // the receive task's batches
+    const size_t batchSize = 16;
+    // USB full speed bulk ceiling, bytes/s
+    const double usbBytesPerSecond = 19 * 64 * 1000;
+
+    template <typename Print>
+    double nanosecondsPerFrame(const std::vector<CANFrame>& frames, Print print) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < frames.size(); i += batchSize)
+            print(&frames[i], frames.size() - i < batchSize ? frames.size() - i : batchSize);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        return std::chrono::duration<double, std::nano>(elapsed).count() / frames.size();
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 2000000;
+
+    CANChannel can(CAN_D1_D2);
+    USBSerial serial;
+    SLCAN slcan(can, serial);
+    slcan.setTimestamps(true);
+    serial.writeRoom = 1 << 30;
+
+    USBSerial binarySerial;
+    SLCAN binarySlcan(can, binarySerial);
+    binarySerial.writeRoom = 1 << 30;
+    binarySerial.feed("B1\r");
+    binarySlcan.readInput(3);
+    binarySerial.takeOutput();
+
+    auto encoder = [&](const CANFrame* frames, size_t n) { slcan.printReceivedMessages(frames, n); };
+    auto binary = [&](const CANFrame* frames, size_t n) { binarySlcan.printReceivedMessages(frames, n); };
+    auto perField = [&](const CANFrame* frames, size_t n) {
+        for (size_t i = 0; i < n; i++)
+            printfMessage(serial, frames[i]);
+    };
+
+    std::vector<CANFrame> sample = makeFrames(256);
+    nanosecondsPerFrame(sample, encoder);
+    std::string encoded = serial.takeOutput();
+    nanosecondsPerFrame(sample, perField);
+    std::string printed = serial.takeOutput();
+    if (encoded != printed) {
+        printf("FAILED: the encoder and printf disagree\n");
+        return 1;
+    }
+    nanosecondsPerFrame(sample, binary);
+    std::string packed = binarySerial.takeOutput();
+    // COBS leaves no zero but the delimiter after each packet
+    if ((size_t)std::count(packed.begin(), packed.end(), '\0') != sample.size()) {
+        printf("FAILED: binary mode didn't send one packet per frame\n");
+        return 1;
+    }
+    double textBytes = (double)encoded.size() / sample.size();
+    double binaryBytes = (double)packed.size() / sample.size();
+
+    serial.capture = false;
+    binarySerial.capture = false;
+    std::vector<CANFrame> frames = makeFrames(count);
+    double encoderCost = nanosecondsPerFrame(frames, encoder);
+    double binaryCost = nanosecondsPerFrame(frames, binary);
+    double printfCost = nanosecondsPerFrame(frames, perField);
+
+    printf("text:    %6.1f ns/frame, %5.2f M frames/s, %4.1f bytes/frame, %6.0f frames/s over USB\n",
+        encoderCost, 1000 / encoderCost, textBytes, usbBytesPerSecond / textBytes);
+    printf("binary:  %6.1f ns/frame, %5.2f M frames/s, %4.1f bytes/frame, %6.0f frames/s over USB\n",
+        binaryCost, 1000 / binaryCost, binaryBytes, usbBytesPerSecond / binaryBytes);
+    printf("printf:  %6.1f ns/frame, %5.2f M frames/s\n", printfCost, 1000 / printfCost);
+    return 0;
+}
@@ -0,0 +1,32 @@
+#include "Mock.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Replaces the global allocator to count calls. Kept out of Mock.cpp so no
+// new-expression is ever compiled against it inline.
+
+static std::atomic<uint64_t> allocationCount(0);
+
+void* operator new(size_t size) {
+    allocationCount++;
+    if (void* pointer = malloc(size ? size : 1))
+        return pointer;
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* pointer) noexcept {
+    free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    free(pointer);
+}
+
+uint64_t Mock::allocations() {
+    return allocationCount;
+}
@@ -0,0 +1,605 @@
+#include "Mock.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <thread>
+
+USBSerial Serial;
+USBSerial USBSerial1;
+SystemClass System;
+BTStackClass ble;
+
+//MARK: clock
+
+namespace {
+    struct Clock {
+        std::mutex mutex;
+        std::condition_variable changed;
+        uint64_t simulated = 0;
+        bool real = false;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::thread::id mainThread = std::this_thread::get_id();
+    };
+
+    // never destroyed, detached threads may still be waiting on it at exit
+    Clock& simulatedClock() {
+        static Clock* instance = new Clock;
+        return *instance;
+    }
+    // constructed before main() runs, on the main thread
+    Clock& clockInstance __attribute__((unused)) = simulatedClock();
+
+    bool onMainThread() {
+        return std::this_thread::get_id() == simulatedClock().mainThread;
+    }
+}
+
+void Mock::useRealClock(bool real) {
+    std::lock_guard<std::mutex> lock(simulatedClock().mutex);
+    simulatedClock().real = real;
+}
+
+uint64_t Mock::now() {
+    Clock& c = simulatedClock();
+    std::lock_guard<std::mutex> lock(c.mutex);
+    if (c.real)
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - c.start).count();
+    return c.simulated;
+}
+
+void Mock::advanceMicros(uint64_t us) {
+    Clock& c = simulatedClock();
+    {
+        std::lock_guard<std::mutex> lock(c.mutex);
+        c.simulated += us;
+    }
+    c.changed.notify_all();
+}
+
+void Mock::advanceMillis(uint64_t ms) {
+    advanceMicros(ms * 1000);
+}
+
+system_tick_t millis() {
+    return (system_tick_t)(Mock::now() / 1000);
+}
+
+unsigned long micros() {
+    return (uint32_t)Mock::now();
+}
+
+static void wait(uint64_t us) {
+    Clock& c = simulatedClock();
+    std::unique_lock<std::mutex> lock(c.mutex);
+    if (c.real) {
+        lock.unlock();
+        std::this_thread::sleep_for(std::chrono::microseconds(us));
+        return;
+    }
+    if (onMainThread()) {
+        lock.unlock();
+        Mock::advanceMicros(us);
+        return;
+    }
+    uint64_t until = c.simulated + us;
+    c.changed.wait(lock, [&]() { return c.real || c.simulated >= until; });
+}
+
+void delay(unsigned long ms) {
+    wait((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+    wait(us);
+}
+
+//MARK: pins
+
+namespace {
+    std::function<int32_t(uint16_t)> analogSource;
+    uint8_t levels[TOTAL_PINS];
+    uint32_t writes[TOTAL_PINS];
+}
+
+void Mock::setAnalogRead(std::function<int32_t(uint16_t pin)> source) {
+    analogSource = source;
+}
+
+uint8_t Mock::pinLevel(uint16_t pin) {
+    return pin < TOTAL_PINS ? levels[pin] : 0;
+}
+
+uint32_t Mock::pinWrites(uint16_t pin) {
+    return pin < TOTAL_PINS ? writes[pin] : 0;
+}
+
+void pinMode(uint16_t pin, PinMode mode) {
+}
+
+void digitalWrite(uint16_t pin, uint8_t value) {
+    if (pin >= TOTAL_PINS)
+        return;
+    levels[pin] = value;
+    writes[pin]++;
+}
+
+int32_t analogRead(uint16_t pin) {
+    int32_t value = analogSource ? analogSource(pin) : 0;
+    return value < 0 ? 0 : value > 4095 ? 4095 : value;
+}
+
+//MARK: serial
+
+size_t Print::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+    size_t written = 0;
+    for (size_t i = 0; i < size; i++)
+        written += write(buffer[i]);
+    return written;
+}
+
+size_t Print::vprintf(bool newline, const char* format, va_list args) {
+    char buffer[256];
+    int length = vsnprintf(buffer, sizeof(buffer), format, args);
+    if (length < 0)
+        return 0;
+    size_t written = write(reinterpret_cast<const uint8_t*>(buffer), (size_t)length < sizeof(buffer) ? length : sizeof(buffer) - 1);
+    if (newline)
+        written += println();
+    return written;
+}
+
+size_t Print::printf(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    size_t written = vprintf(false, format, args);
+    va_end(args);
+    return written;
+}
+
+size_t Print::printlnf(const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    size_t written = vprintf(true, format, args);
+    va_end(args);
+    return written;
+}
+
+int USBSerial::available() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return input.size() - inputPos;
+}
+
+int USBSerial::read() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (inputPos == input.size())
+        return -1;
+    return (uint8_t)input[inputPos++];
+}
+
+int USBSerial::peek() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (inputPos == input.size())
+        return -1;
+    return (uint8_t)input[inputPos];
+}
+
+size_t USBSerial::write(uint8_t c) {
+    return write(&c, 1);
+}
+
+size_t USBSerial::write(const uint8_t* buffer, size_t size) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (capture)
+        output.append(reinterpret_cast<const char*>(buffer), size);
+    if (echo)
+        fwrite(buffer, 1, size, stdout);
+    return size;
+}
+
+void USBSerial::feed(const std::string& bytes) {
+    std::lock_guard<std::mutex> lock(mutex);
+    input.erase(0, inputPos);
+    inputPos = 0;
+    input += bytes;
+}
+
+std::string USBSerial::takeOutput() {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::string taken;
+    taken.swap(output);
+    return taken;
+}
+
+//MARK: system
+
+namespace {
+    uint32_t sleepCount = 0;
+    uint32_t resetCount = 0;
+    std::vector<Mock::ParameterRequest> requests;
+    int requestResult = 0;
+}
+
+void SystemClass::sleep(Sleep_Mode_TypeDef mode, long seconds) {
+    sleepCount++;
+}
+
+void SystemClass::sleep(uint16_t pin, InterruptMode edge, long seconds) {
+    sleepCount++;
+}
+
+void SystemClass::reset() {
+    resetCount++;
+}
+
+uint32_t SystemClass::freeMemory() {
+    return 64 * 1024;
+}
+
+uint32_t Mock::sleeps() {
+    return sleepCount;
+}
+
+uint32_t Mock::resets() {
+    return resetCount;
+}
+
+std::vector<Mock::ParameterRequest>& Mock::parameterRequests() {
+    return requests;
+}
+
+void Mock::setParameterRequestResult(int result) {
+    requestResult = result;
+}
+
+int gap_request_connection_parameter_update(hci_con_handle_t con_handle, uint16_t conn_interval_min,
+    uint16_t conn_interval_max, uint16_t conn_latency, uint16_t supervision_timeout) {
+    requests.push_back({ con_handle, conn_interval_min, conn_interval_max, conn_latency, supervision_timeout });
+    return requestResult;
+}
+
+//MARK: threads
+
+Thread::Thread(const char* name, os_thread_fn_t function, void* function_param,
+    os_thread_prio_t priority, size_t stack_size) {
+    std::thread(function, function_param).detach();
+}
+
+namespace {
+    struct Semaphore {
+        std::mutex mutex;
+        std::condition_variable given;
+        unsigned count;
+        unsigned max;
+    };
+}
+
+int os_semaphore_create(os_semaphore_t* semaphore, unsigned max, unsigned initial) {
+    Semaphore* created = new Semaphore;
+    created->count = initial;
+    created->max = max;
+    *semaphore = created;
+    return 0;
+}
+
+int os_semaphore_destroy(os_semaphore_t semaphore) {
+    delete static_cast<Semaphore*>(semaphore);
+    return 0;
+}
+
+int os_semaphore_take(os_semaphore_t semaphore, system_tick_t timeout, bool reserved) {
+    Semaphore& s = *static_cast<Semaphore*>(semaphore);
+    std::unique_lock<std::mutex> lock(s.mutex);
+
+    bool real;
+    {
+        std::lock_guard<std::mutex> clockLock(simulatedClock().mutex);
+        real = simulatedClock().real;
+    }
+
+    if (real) {
+        if (!s.given.wait_for(lock, std::chrono::milliseconds(timeout), [&]() { return s.count > 0; }))
+            return 1;
+    } else if (s.count == 0) {
+        lock.unlock();
+        wait((uint64_t)timeout * 1000);
+        lock.lock();
+        if (s.count == 0)
+            return 1;
+    }
+
+    s.count--;
+    return 0;
+}
+
+int os_semaphore_give(os_semaphore_t semaphore, bool reserved) {
+    Semaphore& s = *static_cast<Semaphore*>(semaphore);
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        if (s.count == s.max)
+            return 1;
+        s.count++;
+    }
+    s.given.notify_one();
+    return 0;
+}
+
+//MARK: CAN
+
+CANChannel::CANChannel(HAL_CAN_Channel channel, uint16_t rxQueueSize, uint16_t txQueueSize)
+    : queue(rxQueueSize) {}
+
+void CANChannel::begin(unsigned long baud, uint32_t flags) {
+    std::lock_guard<std::mutex> lock(mutex);
+    enabled = true;
+    this->baud = baud;
+    this->flags = flags;
+    head = 0;
+    count = 0;
+}
+
+void CANChannel::end() {
+    std::lock_guard<std::mutex> lock(mutex);
+    enabled = false;
+    count = 0;
+}
+
+uint8_t CANChannel::available() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return count;
+}
+
+bool CANChannel::receive(CANMessage& message) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!enabled || count == 0)
+        return false;
+    message = queue[head];
+    head = (head + 1) % queue.size();
+    count--;
+    return true;
+}
+
+bool CANChannel::transmit(const CANMessage& message) {
+    if (!isEnabled() || status == CAN_BUS_OFF || transmitRoom == 0)
+        return false;
+    if (transmitRoom > 0)
+        transmitRoom--;
+    transmitted.push_back(message);
+    return true;
+}
+
+bool CANChannel::isEnabled() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return enabled;
+}
+
+bool CANChannel::addFilter(uint32_t id, uint32_t mask, HAL_CAN_Filters type) {
+    std::lock_guard<std::mutex> lock(mutex);
+    // the controller has 14 filter banks per channel
+    if (filters.size() == 14)
+        return false;
+    filters.push_back({ id, mask, type });
+    return true;
+}
+
+void CANChannel::clearFilters() {
+    std::lock_guard<std::mutex> lock(mutex);
+    filters.clear();
+}
+
+CANErrorStatus CANChannel::errorStatus() {
+    return status;
+}
+
+std::vector<CANChannel::Filter> CANChannel::getFilters() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return filters;
+}
+
+static bool matches(const std::vector<CANChannel::Filter>& filters, const CANMessage& message) {
+    // no filters lets everything through
+    if (filters.empty())
+        return true;
+    for (const CANChannel::Filter& filter : filters) {
+        if ((filter.type == CAN_FILTER_EXTENDED) != message.extended)
+            continue;
+        if ((message.id & filter.mask) == (filter.id & filter.mask))
+            return true;
+    }
+    return false;
+}
+
+bool CANChannel::accepts(const CANMessage& message) {
+    std::lock_guard<std::mutex> lock(mutex);
+    return matches(filters, message);
+}
+
+bool CANChannel::inject(const CANMessage& message) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!enabled)
+        return false;
+    if (!matches(filters, message)) {
+        filtered++;
+        return false;
+    }
+    if (count == queue.size()) {
+        overflows++;
+        return false;
+    }
+    queue[(head + count) % queue.size()] = message;
+    count++;
+    return true;
+}
+
+//MARK: btstack
+
+void BTStackClass::init() {
+    // handle 0 is invalid
+    attributes.assign(1, Attribute());
+    updates.clear();
+    connected = false;
+    advertising = false;
+    advertisingStarts = 0;
+}
+
+void BTStackClass::setAdvertisementParams(advParams_t* params) {
+    advertisingParameters = *params;
+}
+
+void BTStackClass::setAdvertisementData(uint16_t size, uint8_t* data) {
+    advertisementData.assign(data, data + size);
+}
+
+void BTStackClass::setScanResponseData(uint16_t size, uint8_t* data) {
+    scanResponseData.assign(data, data + size);
+}
+
+void BTStackClass::startAdvertising() {
+    advertising = true;
+    advertisingStarts++;
+}
+
+int BTStackClass::stopAdvertising() {
+    advertising = false;
+    return 0;
+}
+
+static std::vector<uint8_t> uuid16(uint16_t uuid) {
+    return { LOW_BYTE(uuid), HIGH_BYTE(uuid) };
+}
+
+uint16_t BTStackClass::addAttribute(std::vector<uint8_t> type, uint16_t flags, const uint8_t* data, uint16_t size) {
+    Attribute attribute;
+    attribute.type = type;
+    attribute.flags = flags;
+    attribute.value.assign(data, data + size);
+    attributes.push_back(attribute);
+    return attributes.size() - 1;
+}
+
+void BTStackClass::addService(uint16_t uuid) {
+    std::vector<uint8_t> value = uuid16(uuid);
+    addAttribute(uuid16(0x2800), ATT_PROPERTY_READ, value.data(), value.size());
+}
+
+void BTStackClass::addService(uint8_t* uuid) {
+    addAttribute(uuid16(0x2800), ATT_PROPERTY_READ, uuid, 16);
+}
+
+uint16_t BTStackClass::addCharacteristic(uint16_t uuid, uint16_t flags, uint8_t* data, uint16_t size) {
+    std::vector<uint8_t> type = uuid16(uuid);
+    addAttribute(uuid16(0x2803), ATT_PROPERTY_READ, type.data(), type.size());
+    uint16_t handle = addAttribute(type, flags, data, size);
+    if (flags & (ATT_PROPERTY_NOTIFY | ATT_PROPERTY_INDICATE)) {
+        uint8_t configuration[2] = { 0, 0 };
+        addAttribute(uuid16(GATT_CLIENT_CHARACTERISTICS_CONFIGURATION),
+            ATT_PROPERTY_READ | ATT_PROPERTY_WRITE | ATT_PROPERTY_DYNAMIC, configuration, 2);
+    }
+    return handle;
+}
+
+uint16_t BTStackClass::addCharacteristic(const uint8_t* uuid, uint16_t flags, uint8_t* data, uint16_t size) {
+    std::vector<uint8_t> type(uuid, uuid + 16);
+    addAttribute(uuid16(0x2803), ATT_PROPERTY_READ, uuid, 16);
+    uint16_t handle = addAttribute(type, flags, data, size);
+    if (flags & (ATT_PROPERTY_NOTIFY | ATT_PROPERTY_INDICATE)) {
+        uint8_t configuration[2] = { 0, 0 };
+        addAttribute(uuid16(GATT_CLIENT_CHARACTERISTICS_CONFIGURATION),
+            ATT_PROPERTY_READ | ATT_PROPERTY_WRITE | ATT_PROPERTY_DYNAMIC, configuration, 2);
+    }
+    return handle;
+}
+
+int BTStackClass::sendNotify(uint16_t handle, uint8_t* data, uint16_t size) {
+    if (!connected || !canSend)
+        return 1;
+    record(handle, false, data, size);
+    return 0;
+}
+
+int BTStackClass::sendIndicate(uint16_t handle, uint8_t* data, uint16_t size) {
+    if (!connected || !canSend)
+        return 1;
+    record(handle, true, data, size);
+    return 0;
+}
+
+void BTStackClass::record(uint16_t handle, bool indicate, const uint8_t* data, uint16_t size) {
+    Update update;
+    update.handle = handle;
+    update.indicate = indicate;
+    update.size = size < sizeof(update.data) ? size : sizeof(update.data);
+    memcpy(update.data, data, update.size);
+    update.time = micros();
+    updates.push_back(update);
+}
+
+void BTStackClass::connect(uint16_t handle) {
+    connected = true;
+    advertising = false;
+    if (connectedCallback)
+        connectedCallback(BLE_STATUS_OK, handle);
+}
+
+void BTStackClass::disconnect() {
+    connected = false;
+    // btstack advertises again by itself
+    advertising = true;
+    if (disconnectedCallback)
+        disconnectedCallback(CONNECTION_HANDLE);
+}
+
+const BTStackClass::Attribute* BTStackClass::attribute(uint16_t handle) const {
+    return handle > 0 && handle < attributes.size() ? &attributes[handle] : nullptr;
+}
+
+uint16_t BTStackClass::read(uint16_t handle, uint8_t* buffer, uint16_t bufferSize) {
+    const Attribute* found = attribute(handle);
+    if (!found)
+        return 0;
+    if ((found->flags & ATT_PROPERTY_DYNAMIC) && readCallback)
+        return readCallback(handle, buffer, bufferSize);
+
+    uint16_t length = found->value.size() < bufferSize ? found->value.size() : bufferSize;
+    memcpy(buffer, found->value.data(), length);
+    return length;
+}
+
+int BTStackClass::write(uint16_t handle, const std::vector<uint8_t>& value) {
+    const Attribute* found = attribute(handle);
+    if (!found)
+        return ATT_ERROR_INVALID_HANDLE;
+    if (!(found->flags & ATT_PROPERTY_DYNAMIC) || !writeCallback)
+        return ATT_ERROR_WRITE_NOT_PERMITTED;
+    // btstack hands over its own buffer, copied on the stack so tests can count allocations
+    uint8_t copy[512];
+    uint16_t size = value.size() < sizeof(copy) ? value.size() : sizeof(copy);
+    memcpy(copy, value.data(), size);
+    return writeCallback(handle, copy, size);
+}
+
+uint16_t BTStackClass::findValue(const uint8_t* type, size_t length) const {
+    for (size_t handle = 1; handle < attributes.size(); handle++) {
+        const Attribute& attribute = attributes[handle];
+        // the declaration before a value is 0x2803
+        if (attribute.type.size() == length && memcmp(attribute.type.data(), type, length) == 0
+            && attributes[handle - 1].type == uuid16(0x2803))
+            return handle;
+    }
+    return 0;
+}
+
+uint16_t BTStackClass::valueHandle(uint16_t uuid) const {
+    std::vector<uint8_t> type = uuid16(uuid);
+    return findValue(type.data(), type.size());
+}
+
+uint16_t BTStackClass::valueHandle(const uint8_t* uuid) const {
+    return findValue(uuid, 16);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+// Controls for the host stand-in of the Particle platform in application.h.
+
+#include "application.h"
+#include <functional>
+
+namespace Mock {
+    //MARK: clock
+
+    // Simulated by default: time only moves when the test says so, or when the
+    // main thread calls delay() or times out on a semaphore. Other threads'
+    // delay() waits for the main thread to move the clock past it.
+    // The real clock is the host's steady clock, for benchmarks.
+    void useRealClock(bool real);
+    // microseconds since the program started, not wrapped
+    uint64_t now();
+    void advanceMicros(uint64_t us);
+    void advanceMillis(uint64_t ms);
+
+    //MARK: pins
+
+    // what analogRead returns, 12 bits. default 0, nothing connected
+    void setAnalogRead(std::function<int32_t(uint16_t pin)> source);
+    // last digitalWrite, and how many there were
+    uint8_t pinLevel(uint16_t pin);
+    uint32_t pinWrites(uint16_t pin);
+
+    //MARK: system
+
+    uint32_t sleeps();
+    uint32_t resets();
+
+    struct ParameterRequest {
+        hci_con_handle_t handle;
+        uint16_t minInterval;
+        uint16_t maxInterval;
+        uint16_t latency;
+        uint16_t timeout;
+    };
+    std::vector<ParameterRequest>& parameterRequests();
+    // what gap_request_connection_parameter_update returns
+    void setParameterRequestResult(int result);
+
+    //MARK: heap
+
+    // operator new calls in the whole program so far, from every thread
+    uint64_t allocations();
+}
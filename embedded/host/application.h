@@ -0,0 +1,383 @@
+#pragma once
+
+// Host stand-in for the parts of Particle's application.h the firmware uses,
+// so embedded/src builds and runs on a desktop for tests and benchmarks.
+// Declarations follow the Particle API, the members marked "host only" are
+// how tests drive and inspect the fake hardware. Mock.h has the rest.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdarg.h>
+#include <string>
+#include <vector>
+#include <mutex>
+
+typedef uint32_t system_tick_t;
+
+#define LOW_BYTE(x) ((uint8_t)((x) & 0xFF))
+#define HIGH_BYTE(x) ((uint8_t)(((x) >> 8) & 0xFF))
+
+#define SYSTEM_THREAD(x) static const int _systemThread __attribute__((unused)) = 0
+#define SYSTEM_MODE(x) static const int _systemMode __attribute__((unused)) = 0
+#define BLE_SETUP(x) static const int _bleSetup __attribute__((unused)) = 0
+
+// the application, called by the host program instead of the system firmware
+void setup();
+void loop();
+
+//MARK: time
+
+// micros() wraps at 32 bits like it does on the device
+system_tick_t millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+//MARK: pins
+
+enum {
+    D0, D1, D2, D3, D4, D5, D6, D7,
+    A0, A1, A2, A3, A4, A5, A6, A7,
+    WKP,
+    TOTAL_PINS
+};
+enum PinMode { INPUT, OUTPUT, INPUT_PULLUP, INPUT_PULLDOWN };
+enum InterruptMode { CHANGE, RISING, FALLING };
+#define HIGH 1
+#define LOW 0
+
+void pinMode(uint16_t pin, PinMode mode);
+void digitalWrite(uint16_t pin, uint8_t value);
+int32_t analogRead(uint16_t pin);
+
+//MARK: serial
+
+class Print {
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c);
+    virtual size_t write(const uint8_t* buffer, size_t size);
+    size_t write(const char* string) { return write(reinterpret_cast<const uint8_t*>(string), strlen(string)); }
+
+    size_t print(const char* string) { return write(string); }
+    size_t println(const char* string) { return print(string) + println(); }
+    size_t println() { return write("\r\n"); }
+    size_t printf(const char* format, ...);
+    size_t printlnf(const char* format, ...);
+
+private:
+    size_t vprintf(bool newline, const char* format, va_list args);
+};
+
+class Stream: public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() {}
+    virtual int availableForWrite() = 0;
+};
+
+class USBSerial: public Stream {
+public:
+    void begin(long baud = 9600) {}
+    bool isConnected() { return true; }
+    operator bool() { return true; }
+
+    int available() override;
+    int read() override;
+    int peek() override;
+    int availableForWrite() override { return writeRoom; }
+    using Print::write;
+    size_t write(uint8_t c) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+
+    // host only: bytes the host side sends
+    void feed(const std::string& bytes);
+    // host only: everything written since the last call
+    std::string takeOutput();
+    // host only: keep what is written for takeOutput(), benchmarks turn this off
+    bool capture = true;
+    // host only: copy what is written to stdout
+    bool echo = false;
+    // host only: what availableForWrite() reports
+    int writeRoom = 1024;
+
+private:
+    std::mutex mutex;
+    std::string input;
+    size_t inputPos = 0;
+    std::string output;
+};
+
+extern USBSerial Serial;
+extern USBSerial USBSerial1;
+
+//MARK: system
+
+enum Sleep_Mode_TypeDef { SLEEP_MODE_WLAN, SLEEP_MODE_DEEP };
+
+class SystemClass {
+public:
+    // host only: counted in Mock, the program carries on
+    void sleep(Sleep_Mode_TypeDef mode, long seconds);
+    void sleep(uint16_t pin, InterruptMode edge, long seconds);
+    void reset();
+    uint32_t freeMemory();
+};
+
+extern SystemClass System;
+
+//MARK: threads
+
+typedef void os_thread_return_t;
+typedef os_thread_return_t (*os_thread_fn_t)(void* param);
+typedef uint8_t os_thread_prio_t;
+#define OS_THREAD_PRIORITY_DEFAULT 2
+#define OS_THREAD_STACK_SIZE_DEFAULT 3072
+
+// a detached std::thread, priorities are ignored
+class Thread {
+public:
+    Thread(const char* name, os_thread_fn_t function, void* function_param = nullptr,
+        os_thread_prio_t priority = OS_THREAD_PRIORITY_DEFAULT, size_t stack_size = OS_THREAD_STACK_SIZE_DEFAULT);
+};
+
+typedef void* os_semaphore_t;
+int os_semaphore_create(os_semaphore_t* semaphore, unsigned max, unsigned initial);
+int os_semaphore_destroy(os_semaphore_t semaphore);
+// 0 once taken, non-zero on timeout. with the simulated clock a timeout moves the clock on
+int os_semaphore_take(os_semaphore_t semaphore, system_tick_t timeout, bool reserved);
+int os_semaphore_give(os_semaphore_t semaphore, bool reserved);
+
+//MARK: CAN
+
+typedef enum { CAN_D1_D2, CAN_C4_C5 } HAL_CAN_Channel;
+typedef enum { CAN_FILTER_STANDARD, CAN_FILTER_EXTENDED } HAL_CAN_Filters;
+typedef enum { CAN_NO_ERROR, CAN_ERROR_PASSIVE, CAN_BUS_OFF } CANErrorStatus;
+#define CAN_TEST_MODE 1
+
+struct CANMessage {
+    uint32_t id;
+    uint8_t size;
+    bool extended;
+    bool rtr;
+    uint8_t len;
+    uint8_t data[8];
+
+    CANMessage(): id(0), size(sizeof(CANMessage)), extended(false), rtr(false), len(0), data{0} {}
+};
+
+// The controller: a bounded receive queue behind the acceptance filters, and a
+// record of everything transmitted. inject() may be called from another thread.
+class CANChannel {
+public:
+    CANChannel(HAL_CAN_Channel channel, uint16_t rxQueueSize = 32, uint16_t txQueueSize = 32);
+
+    void begin(unsigned long baud, uint32_t flags = 0);
+    void end();
+    uint8_t available();
+    bool receive(CANMessage& message);
+    bool transmit(const CANMessage& message);
+    bool isEnabled();
+    bool addFilter(uint32_t id, uint32_t mask, HAL_CAN_Filters type = CAN_FILTER_STANDARD);
+    void clearFilters();
+    CANErrorStatus errorStatus();
+
+    struct Filter {
+        uint32_t id;
+        uint32_t mask;
+        HAL_CAN_Filters type;
+    };
+
+    // host only: a frame arriving from the bus. false if it didn't reach the
+    // receive queue, because the channel is off, it was filtered or the queue is full
+    bool inject(const CANMessage& message);
+    // host only: whether the filters let the frame through
+    bool accepts(const CANMessage& message);
+    std::vector<Filter> getFilters();
+
+    // host only
+    unsigned long baud = 0;
+    uint32_t flags = 0;
+    CANErrorStatus status = CAN_NO_ERROR;
+    // frames the controller takes before transmit() fails, negative for no limit
+    int transmitRoom = -1;
+    std::vector<CANMessage> transmitted;
+    uint32_t filtered = 0;
+    uint32_t overflows = 0;
+
+private:
+    std::mutex mutex;
+    bool enabled = false;
+    std::vector<Filter> filters;
+    // ring, allocated once so the benchmarks don't count it
+    std::vector<CANMessage> queue;
+    size_t head = 0;
+    size_t count = 0;
+};
+
+//MARK: btstack
+
+#define ATT_ERROR_INVALID_HANDLE 0x01
+#define ATT_ERROR_READ_NOT_PERMITTED 0x02
+#define ATT_ERROR_WRITE_NOT_PERMITTED 0x03
+#define ATT_ERROR_INVALID_PDU 0x04
+#define ATT_ERROR_INSUFFICIENT_AUTHENTICATION 0x05
+#define ATT_ERROR_REQUEST_NOT_SUPPORTED 0x06
+#define ATT_ERROR_INVALID_OFFSET 0x07
+#define ATT_ERROR_INSUFFICIENT_AUTHORIZATION 0x08
+#define ATT_ERROR_PREPARE_QUEUE_FULL 0x09
+#define ATT_ERROR_ATTRIBUTE_NOT_FOUND 0x0a
+#define ATT_ERROR_ATTRIBUTE_NOT_LONG 0x0b
+#define ATT_ERROR_INSUFFICIENT_ENCRYPTION_KEY_SIZE 0x0c
+#define ATT_ERROR_INVALID_ATTRIBUTE_VALUE_LENGTH 0x0d
+#define ATT_ERROR_UNLIKELY_ERROR 0x0e
+#define ATT_ERROR_INSUFFICIENT_ENCRYPTION 0x0f
+#define ATT_ERROR_UNSUPPORTED_GROUP_TYPE 0x10
+#define ATT_ERROR_INSUFFICIENT_RESOURCES 0x11
+
+#define ATT_PROPERTY_BROADCAST 0x01
+#define ATT_PROPERTY_READ 0x02
+#define ATT_PROPERTY_WRITE_WITHOUT_RESPONSE 0x04
+#define ATT_PROPERTY_WRITE 0x08
+#define ATT_PROPERTY_NOTIFY 0x10
+#define ATT_PROPERTY_INDICATE 0x20
+#define ATT_PROPERTY_AUTHENTICATED_SIGNED_WRITE 0x40
+#define ATT_PROPERTY_EXTENDED_PROPERTIES 0x80
+#define ATT_PROPERTY_DYNAMIC 0x100
+
+#define GATT_CLIENT_CHARACTERISTICS_CONFIGURATION 0x2902
+#define GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_NOTIFICATION 1
+#define GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_INDICATION 2
+
+#define BLE_UUID_GAP 0x1800
+#define BLE_UUID_GATT 0x1801
+#define BLE_UUID_GAP_CHARACTERISTIC_DEVICE_NAME 0x2A00
+#define BLE_UUID_GAP_CHARACTERISTIC_APPEARANCE 0x2A01
+#define BLE_UUID_GAP_CHARACTERISTIC_PPCP 0x2A04
+#define BLE_UUID_GATT_CHARACTERISTIC_SERVICE_CHANGED 0x2A05
+#define BLE_APPEARANCE_UNKNOWN 0
+
+#define BD_ADDR_LEN 6
+#define BLE_GAP_ADV_TYPE_ADV_IND 0x00
+#define BLE_GAP_ADDR_TYPE_PUBLIC 0x00
+#define BLE_GAP_ADV_CHANNEL_MAP_ALL 0x07
+#define BLE_GAP_ADV_FP_ANY 0x00
+#define BLE_GAP_AD_TYPE_FLAGS 0x01
+#define BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE 0x06
+#define BLE_GAP_AD_TYPE_128BIT_SERVICE_UUID_MORE_AVAILABLE 0x06
+#define BLE_GAP_AD_TYPE_COMPLETE_LOCAL_NAME 0x09
+
+typedef struct {
+    uint16_t adv_int_min;
+    uint16_t adv_int_max;
+    uint8_t adv_type;
+    uint8_t dir_addr_type;
+    uint8_t dir_addr[BD_ADDR_LEN];
+    uint8_t channel_map;
+    uint8_t filter_policy;
+} advParams_t;
+
+typedef enum {
+    BLE_STATUS_OK,
+    BLE_STATUS_DONE,
+    BLE_STATUS_CONNECTION_TIMEOUT,
+    BLE_STATUS_CONNECTION_ERROR,
+    BLE_STATUS_OTHER_ERROR
+} BLEStatus_t;
+
+typedef uint16_t hci_con_handle_t;
+
+// 0 when queued, recorded in Mock
+int gap_request_connection_parameter_update(hci_con_handle_t con_handle, uint16_t conn_interval_min,
+    uint16_t conn_interval_max, uint16_t conn_latency, uint16_t supervision_timeout);
+
+// The attribute server: handles are handed out in order like btstack does, only
+// dynamic attributes and client configurations reach the read and write callbacks.
+class BTStackClass {
+public:
+    void init();
+    void deInit() {}
+    void debugLogger(bool enabled) {}
+    void debugError(bool enabled) {}
+    void enablePacketLogger() {}
+
+    void setAdvertisementParams(advParams_t* params);
+    void setAdvertisementData(uint16_t size, uint8_t* data);
+    void setScanResponseData(uint16_t size, uint8_t* data);
+    void startAdvertising();
+    int stopAdvertising();
+
+    void onDataReadCallback(uint16_t (*callback)(uint16_t handle, uint8_t* buffer, uint16_t bufferSize)) { readCallback = callback; }
+    void onDataWriteCallback(int (*callback)(uint16_t handle, uint8_t* buffer, uint16_t bufferSize)) { writeCallback = callback; }
+    void onConnectedCallback(void (*callback)(BLEStatus_t status, uint16_t handle)) { connectedCallback = callback; }
+    void onDisconnectedCallback(void (*callback)(uint16_t handle)) { disconnectedCallback = callback; }
+
+    void addService(uint16_t uuid);
+    void addService(uint8_t* uuid);
+    uint16_t addCharacteristic(uint16_t uuid, uint16_t flags, uint8_t* data, uint16_t size);
+    uint16_t addCharacteristic(const uint8_t* uuid, uint16_t flags, uint8_t* data, uint16_t size);
+
+    int attServerCanSendPacket() { return canSend; }
+    int sendNotify(uint16_t handle, uint8_t* data, uint16_t size);
+    int sendIndicate(uint16_t handle, uint8_t* data, uint16_t size);
+
+    struct Attribute {
+        // 2 or 16 bytes, as passed in
+        std::vector<uint8_t> type;
+        uint16_t flags;
+        std::vector<uint8_t> value;
+    };
+    // recorded inline so benchmarks can count the firmware's allocations alone,
+    // reserve updates up front
+    struct Update {
+        uint16_t handle;
+        bool indicate;
+        uint16_t size;
+        uint8_t data[64];
+        uint32_t time;
+
+        std::vector<uint8_t> bytes() const { return std::vector<uint8_t>(data, data + size); }
+    };
+
+    // host only: the central's side of the link
+    void connect(uint16_t handle = CONNECTION_HANDLE);
+    void disconnect();
+    // a read request, through the callback for dynamic attributes. returns the length
+    uint16_t read(uint16_t handle, uint8_t* buffer, uint16_t bufferSize);
+    // returns the ATT error, 0 on success
+    int write(uint16_t handle, const std::vector<uint8_t>& value);
+    // value handle of a characteristic, 0 if there is none
+    uint16_t valueHandle(uint16_t uuid) const;
+    uint16_t valueHandle(const uint8_t* uuid) const;
+    // its client configuration comes right after the value
+    uint16_t configurationHandle(const uint8_t* uuid) const { return valueHandle(uuid) + 1; }
+    const Attribute* attribute(uint16_t handle) const;
+
+    static constexpr uint16_t CONNECTION_HANDLE = 0x40;
+
+    // host only
+    std::vector<Attribute> attributes;
+    std::vector<Update> updates;
+    int canSend = 1;
+    bool connected = false;
+    bool advertising = false;
+    uint32_t advertisingStarts = 0;
+    advParams_t advertisingParameters = {};
+    std::vector<uint8_t> advertisementData;
+    std::vector<uint8_t> scanResponseData;
+
+private:
+    uint16_t addAttribute(std::vector<uint8_t> type, uint16_t flags, const uint8_t* data, uint16_t size);
+    uint16_t findValue(const uint8_t* type, size_t length) const;
+    void record(uint16_t handle, bool indicate, const uint8_t* data, uint16_t size);
+
+    uint16_t (*readCallback)(uint16_t, uint8_t*, uint16_t) = nullptr;
+    int (*writeCallback)(uint16_t, uint8_t*, uint16_t) = nullptr;
+    void (*connectedCallback)(BLEStatus_t, uint16_t) = nullptr;
+    void (*disconnectedCallback)(uint16_t) = nullptr;
+};
+
+extern BTStackClass ble;
@@ -0,0 +1,15 @@
+#pragma once
+
+// Host stand-in for the pins the firmware uses from the carloop library
+// (particle library copy carloop), which isn't vendored.
+
+#include "application.h"
+
+struct CarloopRevision2 {
+    static const uint16_t CAN_ENABLE_PIN = D5;
+    static const uint8_t CAN_ENABLE_ACTIVE = LOW;
+    static const uint8_t CAN_ENABLE_INACTIVE = HIGH;
+    static const uint16_t BATTERY_PIN = A6;
+    // volts at the battery per volt at the pin
+    static constexpr float BATTERY_FACTOR = 5.54f;
+};
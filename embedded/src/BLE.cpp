@@ -1,92 +1,21 @@
 #include "BLE.h"
-#include <assert.h>
-#include <sstream>
 
 //MARK: UUID
-// 16 bit
-BLE::UUID::UUID(uint16_t data) {
-    this->data = { LOW_BYTE(data), HIGH_BYTE(data) };
-}
-
-// 128 bit
-BLE::UUID::UUID(const uint8_t (&data)[16]) {
-    this->data = std::vector<uint8_t>(data, data + 16);
-}
-
-// converts a single hex char to a number (0 - 15)
-// https://github.com/graeme-hill/crossguid/blob/master/src/guid.cpp#L161
-uint8_t hexDigitToChar(char ch) {
-    // 0-9
-    if (ch > 47 && ch < 58)
-        return ch - 48;
-
-    // a-f
-    if (ch > 96 && ch < 103)
-        return ch - 87;
-
-    // A-F
-    if (ch > 64 && ch < 71)
-        return ch - 55;
-
+uint8_t BLE::UUID::invalidCharacter() {
+    // only reachable when a UUID is built from a string at runtime
+    Serial.println("Invalid UUID string!");
     return 0;
 }
 
-// 128 bit
-BLE::UUID::UUID(const std::string string) {
-    std::vector<uint8_t> data;
-
-    // char 1 is upper bytes, char 2 is lower bytes
-    char char1;
-    char char2;
-    bool wantsCharOne = true;
-    for (char c : string) {
-        if (c == '-')
-            continue;
-
-        if (wantsCharOne)
-            char1 = c;
-        else {
-            char2 = c;
-
-            uint8_t combined = hexDigitToChar(char1) * 16 + hexDigitToChar(char2);
-            data.push_back(combined);
-        }
-
-        wantsCharOne = !wantsCharOne;
-    }
-    this->data = data;
-}
-
-bool BLE::UUID::is16() const {
-    return data.size() == 2;
-}
-
-bool BLE::UUID::is128() const {
-    // lol
-    return !is16();
-}
-
-uint16_t BLE::UUID::data16() const {
-    uint8_t byte1 = data[0];
-    uint8_t byte2 = data[1];
-    return (byte2 << 8) | byte1;
-}
-
-const uint8_t* BLE::UUID::data128() const {
-    return data.data();
-}
-
 //MARK: Characteristic
+// notifications and indications off
+const uint8_t unsubscribed[] = { 0, 0 };
+
 BLE::Characteristic::Characteristic(const UUID& type, const Properties& properties): type(type), properties(properties) {
-    if (isNotify()) {
-        this->clientConfigurationDescriptor = std::make_shared<MutableDescriptor>(
-            UUID(GATT_CLIENT_CHARACTERISTICS_CONFIGURATION),
-            std::vector<uint8_t>{ 0, 0 });
-    }
-    if (isIndicate()) {
-        this->clientConfigurationDescriptor = std::make_shared<MutableDescriptor>(
+    if (isNotify() || isIndicate()) {
+        this->clientConfigurationDescriptor = std::make_shared<MutableDescriptor<2>>(
             UUID(GATT_CLIENT_CHARACTERISTICS_CONFIGURATION),
-            std::vector<uint8_t>{ 0, 0 });
+            Bytes(unsubscribed));
     }
 }
 
@@ -95,8 +24,8 @@ void BLE::Characteristic::addDescriptor(std::shared_ptr<Descriptor> descriptor)
     descriptor->characteristic = shared_from_this();
 }
 
-void BLE::IndicateCharacteristic::sendIndicate() {
-    if (handle == -1) {
+void BLE::Characteristic::sendIndicate() {
+    if (!manager) {
         Serial.println("Characteristic has not been added! Cannot send indicate");
         return;
     }
@@ -111,13 +40,11 @@ void BLE::IndicateCharacteristic::sendIndicate() {
         return;
     }
 
-    const std::vector<uint8_t>& value = getValue();
-    // btstack makes a copy, even though it isn't marked as such
-    ble.sendIndicate(handle, const_cast<uint8_t*>(value.data()), value.size());
+    manager->enqueueUpdate(*this, true);
 }
 
-void BLE::NotifyCharacteristic::sendNotify() {
-    if (handle == -1) {
+void BLE::Characteristic::sendNotify() {
+    if (!manager) {
         Serial.println("Characteristic has not been added! Cannot send notify");
         return;
     }
@@ -132,18 +59,15 @@ void BLE::NotifyCharacteristic::sendNotify() {
         return;
     }
 
-    if (!ble.attServerCanSendPacket()) {
-        Serial.println("Attempted to notify but att server busy, cannot send packet");
-        return;
-    }
+    manager->enqueueUpdate(*this, false);
+}
 
-    const std::vector<uint8_t>& value = getValue();
-    // btstack makes a copy, even though it isn't marked as such
-    ble.sendNotify(handle, const_cast<uint8_t*>(value.data()), value.size());
+bool BLE::Characteristic::isSubscribed() const {
+    return clientConfigurationDescriptor && clientConfigurationDescriptor->getValue()[0] != 0;
 }
 
 //MARK: Service
-BLE::Service::Service(UUID type) : type(type) {
+BLE::Service::Service(const GattEntry* schema, size_t schemaSize) : schema(schema), schemaSize(schemaSize) {
 }
 
 void BLE::Service::addCharacteristic(std::shared_ptr<Characteristic> characteristic) {
@@ -212,7 +136,39 @@ BLE::Manager::~Manager() {
     ble.deInit();
 }
 
-void BLE::Manager::addService(std::shared_ptr<Service> service) {
+bool BLE::Manager::matchesSchema(const Service& service) const {
+    const GattEntry* schema = service.getSchema();
+    const std::vector<std::shared_ptr<Characteristic>>& characteristics = service.getCharacteristics();
+
+    if (service.getSchemaSize() != characteristics.size() + 1 || schema[0].kind != GattEntry::Kind::Service) {
+        Serial.println("Service does not match its schema!");
+        return false;
+    }
+
+    for (size_t i = 0; i < characteristics.size(); i++) {
+        const GattEntry& entry = schema[i + 1];
+        const Characteristic& characteristic = *characteristics[i];
+        if (entry.kind != GattEntry::Kind::Characteristic
+            || entry.type != characteristic.getType()
+            || entry.properties != characteristic.getProperties()) {
+            Serial.printlnf("Characteristic %d does not match its schema!", i);
+            return false;
+        }
+    }
+
+    if (nextHandle + handleCount(schema, service.getSchemaSize()) > MAX_HANDLES) {
+        Serial.println("Out of ATT handles, raise MAX_HANDLES!");
+        return false;
+    }
+
+    return true;
+}
+
+bool BLE::Manager::addService(std::shared_ptr<Service> service) {
+    // checked before anything reaches btstack, it cannot be taken back out
+    if (!matchesSchema(*service))
+        return false;
+
     services.push_back(service);
 
     if (service->getType().is16()) {
@@ -220,30 +176,45 @@ void BLE::Manager::addService(std::shared_ptr<Service> service) {
     } else {
         ble.addService(const_cast<uint8_t*>(service->getType().data128()));
     }
+    nextHandle += service->getSchema()[0].handleCount();
 
+    const GattEntry* entry = service->getSchema() + 1;
     for (const std::shared_ptr<Characteristic>& characteristic : service->getCharacteristics()) {
+        // declaration comes first, then the value
+        uint16_t expectedHandle = nextHandle + 1;
+        nextHandle += entry->handleCount();
+
         // add the characteristic
         uint16_t handle;
         if (characteristic->getType().is16()) {
             handle = ble.addCharacteristic(
                 characteristic->getType().data16(),
                 static_cast<uint16_t>(characteristic->getProperties()),
-                const_cast<uint8_t*>(characteristic->getValue().data()),
-                characteristic->getValue().size());
+                const_cast<uint8_t*>(characteristic->getValue().data),
+                characteristic->getValue().size);
         } else {
             handle = ble.addCharacteristic(
                 const_cast<uint8_t*>(characteristic->getType().data128()),
                 static_cast<uint16_t>(characteristic->getProperties()),
-                const_cast<uint8_t*>(characteristic->getValue().data()),
-                characteristic->getValue().size());
+                const_cast<uint8_t*>(characteristic->getValue().data),
+                characteristic->getValue().size);
+        }
+
+        // every handle after this one would be off too, nothing is wired up
+        if (handle != expectedHandle) {
+            Serial.printlnf("Characteristic handle %d does not match schema handle %d!", handle, expectedHandle);
+            return false;
         }
 
-        characteristicHandles[handle] = characteristic;
+        attributes[handle].characteristic = characteristic.get();
         characteristic->handle = handle;
+        characteristic->manager = this;
         Serial.printlnf("Added characteristic handle: %d", handle);
 
         // add the other descriptors
         for (const std::shared_ptr<Descriptor>& descriptor : characteristic->getDescriptors()) {
+            // only used by the disabled code below
+            (void)descriptor;
             uint16_t handle = 0;
 //            if (descriptor->getType().is16()) {
 //                handle = ble.addDescriptor(
@@ -259,57 +230,261 @@ void BLE::Manager::addService(std::shared_ptr<Service> service) {
 //                    descriptor->getValue().size());
 //            }
 //
-//            descriptorHandles[handle] = descriptor;
+//            attributes[handle].descriptor = descriptor.get();
             Serial.printlnf("Added descriptor handle: %d", handle);
         }
 
-        // client characteristic configuration descriptor
+        // client characteristic configuration descriptor, right after the value per the schema
         if (std::shared_ptr<Descriptor> descriptor = characteristic->clientConfigurationDescriptor) {
-            descriptorHandles[handle + 1] = descriptor;
+            attributes[handle + 1].descriptor = descriptor.get();
             Serial.printlnf("Added client characteristic configuration descriptor handle: %d", handle + 1);
         }
+
+        entry++;
     }
+
+    return true;
 }
 
-uint16_t BLE::Manager::onReadCallback(uint16_t handle, uint8_t* buffer, uint16_t bufferSize) {
-    std::shared_ptr<Characteristic> characteristic = characteristicHandles[handle];
-    if (characteristic) {
-        const std::vector<uint8_t>& value = characteristic->getValue();
-        // if buffer is null, don't copy and just return size
-        if (buffer)
-            memcpy(buffer, value.data(), bufferSize);
-        Serial.printlnf("Read characteristic, handle: %d, size: %d", handle, value.size());
-        return value.size();
+bool BLE::Manager::enqueueUpdate(const Characteristic& characteristic, bool indicate) {
+    discardStaleUpdates();
+
+    Bytes value = characteristic.getValue();
+    if (value.size > MAX_UPDATE_LENGTH) {
+        Serial.printlnf("Update too long to queue, handle: %d, size: %d", characteristic.handle, value.size);
+        queueStatistics.dropped++;
+        return false;
     }
 
-    std::shared_ptr<Descriptor> descriptor = descriptorHandles[handle];
-    if (descriptor) {
-        const std::vector<uint8_t>& value = descriptor->getValue();
-        // if buffer is null, don't copy and just return size
-        if (buffer)
-            memcpy(buffer, value.data(), bufferSize);
-        Serial.printlnf("Read characteristic, handle: %d, size: %d", handle, value.size());
-        return value.size();
+    PendingUpdate* update = nullptr;
+
+    // a pending value that has not gone out yet is simply replaced
+    if (characteristic.getUpdatePolicy() == UpdatePolicy::Coalesce) {
+        for (size_t i = 0; i < pendingCount; i++) {
+            PendingUpdate& pending = pendingUpdates[(pendingHead + i) % UPDATE_QUEUE_CAPACITY];
+            if (pending.handle == characteristic.handle && pending.indicate == indicate) {
+                update = &pending;
+                queueStatistics.coalesced++;
+                break;
+            }
+        }
+    }
+
+    if (!update) {
+        if (pendingCount == UPDATE_QUEUE_CAPACITY) {
+            Serial.printlnf("Update queue full, dropping update for handle: %d", characteristic.handle);
+            queueStatistics.dropped++;
+            return false;
+        }
+
+        update = &pendingUpdates[(pendingHead + pendingCount) % UPDATE_QUEUE_CAPACITY];
+        update->queuedAt = micros();
+        pendingCount++;
+        queueStatistics.enqueued++;
+        if (pendingCount > queueStatistics.highWaterMark)
+            queueStatistics.highWaterMark = pendingCount;
     }
 
+    update->handle = characteristic.handle;
+    update->indicate = indicate;
+    update->length = value.size;
+    memcpy(update->data, value.data, value.size);
+
+    // try right away, most of the time the link is idle
+    process();
+    return true;
+}
+
+void BLE::Manager::discardStaleUpdates() {
+    if (!discardPendingUpdates)
+        return;
+
+    // updates were meant for the previous connection
+    discardPendingUpdates = false;
+    pendingHead = 0;
+    pendingCount = 0;
+}
+
+void BLE::Manager::process() {
+    discardStaleUpdates();
+
+    if (!connected) {
+        updateAdvertising();
+        return;
+    }
+
+    updateConnectionParameters();
+
+    if (serviceChangedPending) {
+        // cleared first, queueing it calls process() again
+        serviceChangedPending = false;
+        if (std::shared_ptr<Characteristic> serviceChangedCharacteristic = this->serviceChangedCharacteristic)
+            serviceChangedCharacteristic->sendIndicate();
+    }
+
+    while (pendingCount > 0 && ble.attServerCanSendPacket()) {
+        PendingUpdate& update = pendingUpdates[pendingHead];
+
+        // btstack makes a copy, even though it isn't marked as such.
+        // a non-zero result means it is still busy (e.g. an indication awaiting
+        // confirmation), keep the update and retry next time
+        int result = update.indicate
+            ? ble.sendIndicate(update.handle, update.data, update.length)
+            : ble.sendNotify(update.handle, update.data, update.length);
+        if (result != 0)
+            break;
+
+        uint32_t delay = micros() - update.queuedAt;
+        connectionStatistics.lastQueueDelay = delay;
+        if (delay > connectionStatistics.maxQueueDelay)
+            connectionStatistics.maxQueueDelay = delay;
+
+        pendingHead = (pendingHead + 1) % UPDATE_QUEUE_CAPACITY;
+        pendingCount--;
+        queueStatistics.sent++;
+    }
+}
+
+void BLE::Manager::wakeAdvertising() {
+    if (connected || !advertising)
+        return;
+
+    advertisingStarted = millis();
+    if (advertisingStep != 0)
+        applyAdvertisingStep(0);
+}
+
+void BLE::Manager::setAdvertisingSchedule(const AdvertisingSchedule& schedule) {
+    advertisingSchedule = schedule;
+    advertisingStep = NO_STEP;
+}
+
+void BLE::Manager::updateAdvertising() {
+    if (!advertising)
+        return;
+
+    // btstack restarts advertising by itself after a disconnect, at whatever
+    // interval was set last
+    if (advertisingStep == NO_STEP) {
+        advertisingStarted = millis();
+        applyAdvertisingStep(0);
+        return;
+    }
+
+    system_tick_t elapsed = millis() - advertisingStarted;
+    size_t step = 0;
+    while (step + 1 < advertisingSchedule.stepCount && elapsed >= advertisingSchedule.steps[step].until)
+        step++;
+
+    if (step != advertisingStep)
+        applyAdvertisingStep(step);
+}
+
+// the interval can only change while advertising is off
+void BLE::Manager::applyAdvertisingStep(size_t step) {
+    uint16_t interval = advertisingSchedule.steps[step].interval;
+    advertisingStep = step;
+    advertisingParameters.adv_int_min = interval;
+    advertisingParameters.adv_int_max = interval;
+
+    ble.stopAdvertising();
+    ble.setAdvertisementParams(&advertisingParameters);
+    ble.startAdvertising();
+    Serial.printlnf("Advertising every %lu us", interval * 625ul);
+}
+
+void BLE::Manager::noteActivity() {
+    lastActivity = millis();
+}
+
+void BLE::Manager::setConnectionPolicy(const ConnectionPolicy& policy) {
+    connectionPolicy = policy;
+    // re-request whichever parameters apply now
+    parametersRequested = false;
+}
+
+void BLE::Manager::updateConnectionParameters() {
+    system_tick_t now = millis();
+    bool active = now - lastActivity < connectionPolicy.idleAfter;
+
+    if (parametersRequested && active == connectionStatistics.active)
+        return;
+    if (now - lastParameterRequest < PARAMETER_REQUEST_INTERVAL)
+        return;
+
+    const ConnectionParameters& parameters = active ? connectionPolicy.active : connectionPolicy.idle;
+    int result = gap_request_connection_parameter_update(
+        connectionHandle,
+        parameters.minInterval,
+        parameters.maxInterval,
+        parameters.slaveLatency,
+        parameters.supervisionTimeout);
+
+    lastParameterRequest = now;
+    connectionStatistics.updatesRequested++;
+    if (result != 0) {
+        // btstack is busy with another l2cap request, try again later
+        connectionStatistics.updatesRefused++;
+        return;
+    }
+
+    Serial.printlnf(
+        "Requested %s connection interval %d-%d, latency %d",
+        active ? "active" : "idle", parameters.minInterval, parameters.maxInterval, parameters.slaveLatency);
+    connectionStatistics.active = active;
+    parametersRequested = true;
+}
+
+uint16_t BLE::Manager::onReadCallback(uint16_t handle, uint8_t* buffer, uint16_t bufferSize) {
+    Attribute attribute = attributeFor(handle);
+
+    if (Characteristic* characteristic = attribute.characteristic)
+        return readValue(handle, characteristic->getValue(), buffer, bufferSize);
+
+    if (Descriptor* descriptor = attribute.descriptor)
+        return readValue(handle, descriptor->getValue(), buffer, bufferSize);
+
     Serial.println("Could not find matching characteristic or descriptor for read!");
     return 0;
 }
 
+uint16_t BLE::Manager::readValue(uint16_t handle, Bytes value, uint8_t* buffer, uint16_t bufferSize) {
+    // if buffer is null, don't copy and just return size
+    if (!buffer)
+        return value.size;
+
+    // never past the end of the value, whatever size btstack asks for. the wrapper
+    // doesn't pass read blob offsets on, so reads always start at the beginning;
+    // every dynamic value here is shorter than DEFAULT_MTU - 1, so one read covers it
+    uint16_t length = bufferSize < value.size ? bufferSize : value.size;
+    memcpy(buffer, value.data, length);
+    Serial.printlnf("Read attribute, handle: %d, length: %d of %d", handle, length, value.size);
+    return length;
+}
+
+void BLE::Manager::resetConnectionState() {
+    // someone just connected, they are probably about to use it
+    lastActivity = millis();
+    parametersRequested = false;
+    connectionStatistics.active = false;
+}
+
 int BLE::Manager::onWriteCallback(uint16_t handle, uint8_t* buffer, uint16_t bufferSize) {
-    std::vector<uint8_t> newValue(buffer, buffer + bufferSize);
+    // written straight from btstack's buffer into the attribute's storage, no copies on the heap
+    Bytes newValue(buffer, bufferSize);
+    Attribute attribute = attributeFor(handle);
 
-    std::shared_ptr<Characteristic> characteristic = characteristicHandles[handle];
-    if (characteristic) {
+    if (Characteristic* characteristic = attribute.characteristic) {
         uint8_t ret = static_cast<uint8_t>(characteristic->setValue(newValue));
         Serial.printlnf("Wrote characteristic, handle: %d, code: %d", handle, ret);
+        notifyEvent();
         return ret;
     }
 
-    std::shared_ptr<Descriptor> descriptor = descriptorHandles[handle];
-    if (descriptor) {
+    if (Descriptor* descriptor = attribute.descriptor) {
         uint8_t ret = static_cast<uint8_t>(descriptor->setValue(newValue));
         Serial.printlnf("Wrote descriptor, handle: %d, code: %d", handle, ret);
+        notifyEvent();
         return ret;
     }
 
@@ -322,11 +497,9 @@ void BLE::Manager::onConnectedCallback(BLEStatus_t status, uint16_t handle) {
         case BLE_STATUS_OK:
             Serial.printlnf("Successfully connected to device! Handle: %d", handle);
             connected = true;
-
-            if (std::shared_ptr<IndicateCharacteristic> serviceChangedCharacteristic = this->serviceChangedCharacteristic) {
-                serviceChangedCharacteristic->sendIndicate();
-            }
-
+            connectionHandle = handle;
+            resetConnectionState();
+            serviceChangedPending = true;
             break;
         case BLE_STATUS_DONE:
             Serial.printlnf("Connection done. Handle: %d", handle);
@@ -341,22 +514,35 @@ void BLE::Manager::onConnectedCallback(BLEStatus_t status, uint16_t handle) {
             Serial.printlnf("Connection other error. Handle: %d", handle);
             break;
     }
+    notifyEvent();
 }
 
 void BLE::Manager::onDisconnectedCallback(uint16_t handle) {
     Serial.printlnf("Device disconnected. Handle: %d", handle);
     connected = false;
+    discardPendingUpdates = true;
+    resetConnectionState();
+    advertisingStep = NO_STEP;
 
-    for (const auto& pair : characteristicHandles) {
-        std::shared_ptr<Characteristic> characteristic = pair.second;
+    for (const Attribute& attribute : attributes) {
+        if (!attribute.characteristic)
+            continue;
 
-        if (std::shared_ptr<Descriptor> descriptor = characteristic->clientConfigurationDescriptor) {
-            descriptor->setValue({ 0, 0 });
+        if (std::shared_ptr<Descriptor> descriptor = attribute.characteristic->clientConfigurationDescriptor) {
+            descriptor->setValue(unsubscribed);
         }
     }
+    notifyEvent();
+}
+
+void BLE::Manager::notifyEvent() {
+    if (eventHandler)
+        eventHandler();
 }
 
 void BLE::Manager::setAdvertisingParameters(advParams_t* advertisingParameters) {
+    // kept, the schedule changes only the interval
+    this->advertisingParameters = *advertisingParameters;
     ble.setAdvertisementParams(advertisingParameters);
 }
 
@@ -369,5 +555,12 @@ void BLE::Manager::setScanResponseData(std::vector<uint8_t>& scanResponseData) {
 }
 
 void BLE::Manager::startAdvertising() {
-    ble.startAdvertising();
+    advertising = true;
+    advertisingStarted = millis();
+    applyAdvertisingStep(0);
+}
+
+void BLE::Manager::stopAdvertising() {
+    advertising = false;
+    ble.stopAdvertising();
 }
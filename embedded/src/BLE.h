@@ -2,28 +2,90 @@
 
 #define PLATFORM_ID 88
 #include "application.h"
-#include <map>
+#include "Hex.h"
+#include <initializer_list>
 #include <memory>
 #include <vector>
 #include <string>
 
 namespace BLE {
     struct UUID {
-        // 16 or 128 bit uuid type
-        UUID(uint16_t data);
-        UUID(const uint8_t (&data)[16]);
-        UUID(const std::string string);
+        // 16 bit
+        constexpr UUID(uint16_t data)
+            : bytes{ static_cast<uint8_t>(data & 0xFF), static_cast<uint8_t>(data >> 8) }, length(2) {}
+
+        // 128 bit, in the order it is written
+        constexpr UUID(const uint8_t (&data)[16])
+            : bytes{
+                data[0], data[1], data[2], data[3], data[4], data[5], data[6], data[7],
+                data[8], data[9], data[10], data[11], data[12], data[13], data[14], data[15] },
+              length(16) {}
+
+        // 128 bit, "XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX"
+        // declare the result constexpr: it is then parsed by the compiler, and a
+        // malformed string fails the build instead of turning into zeroes at boot
+        template <size_t N>
+        constexpr UUID(const char (&string)[N])
+            : bytes{
+                parseByte(string, 0), parseByte(string, 1), parseByte(string, 2), parseByte(string, 3),
+                parseByte(string, 4), parseByte(string, 5), parseByte(string, 6), parseByte(string, 7),
+                parseByte(string, 8), parseByte(string, 9), parseByte(string, 10), parseByte(string, 11),
+                parseByte(string, 12), parseByte(string, 13), parseByte(string, 14), parseByte(string, 15) },
+              length(16) {
+            static_assert(N == 37, "128 bit UUIDs must be written as XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX");
+        }
+
+        constexpr bool is16() const { return length == 2; }
+        constexpr bool is128() const { return length == 16; }
 
-        bool is16() const;
-        bool is128() const;
+        constexpr uint16_t data16() const { return (bytes[1] << 8) | bytes[0]; }
+        // btstack doesn't mark anything as const, but only ever reads this
+        const uint8_t* data128() const { return bytes; }
+        // byte at index when sent little endian, as in advertisement data.
+        // 16 bit UUIDs are already stored that way, 128 bit ones as written
+        constexpr uint8_t littleEndian(size_t index) const { return is16() ? bytes[index] : bytes[length - 1 - index]; }
 
-        uint16_t data16() const;
-        const uint8_t* data128() const;
+        constexpr bool operator == (const UUID& other) const {
+            return length == other.length && equalFrom(other, 0);
+        }
+        constexpr bool operator != (const UUID& other) const {
+            return !(*this == other);
+        }
+        // FNV-1a
+        constexpr uint32_t hash() const {
+            return hashFrom(0, 2166136261u);
+        }
 
+    private:
         // len 16 = 128 bits
         // len 2 = 16 bits
-        // cheating here but btstack doesn't mark anything as const ugh
-        mutable std::vector<uint8_t> data;
+        uint8_t bytes[16];
+        uint8_t length;
+
+        constexpr bool equalFrom(const UUID& other, size_t index) const {
+            return index == length || (bytes[index] == other.bytes[index] && equalFrom(other, index + 1));
+        }
+        constexpr uint32_t hashFrom(size_t index, uint32_t hash) const {
+            return index == length ? hash : hashFrom(index + 1, (hash ^ bytes[index]) * 16777619u);
+        }
+
+        // position of byte index in the string, skipping the dashes
+        static constexpr size_t offsetOf(size_t index) {
+            return index * 2 + (index >= 4) + (index >= 6) + (index >= 8) + (index >= 10);
+        }
+        static constexpr bool hasDashBefore(size_t index) {
+            return index == 4 || index == 6 || index == 8 || index == 10;
+        }
+        static constexpr uint8_t hexDigit(char c) {
+            return (Hex::digitValue(c) & Hex::INVALID) ? invalidCharacter() : Hex::digitValue(c);
+        }
+        static constexpr uint8_t parseByte(const char* string, size_t index) {
+            return (hasDashBefore(index) && string[offsetOf(index) - 1] != '-')
+                ? invalidCharacter()
+                : static_cast<uint8_t>((hexDigit(string[offsetOf(index)]) << 4) | hexDigit(string[offsetOf(index) + 1]));
+        }
+        // not constexpr on purpose: reaching it during constant evaluation is a compile error
+        static uint8_t invalidCharacter();
     };
 
     enum class Error: uint8_t {
@@ -59,17 +121,110 @@ namespace BLE {
         ExtendedProperties = ATT_PROPERTY_EXTENDED_PROPERTIES,
         Dynamic = ATT_PROPERTY_DYNAMIC
     };
-    inline Properties operator | (Properties lhs, Properties rhs) {
+    constexpr Properties operator | (Properties lhs, Properties rhs) {
         return static_cast<Properties>(static_cast<uint16_t>(lhs) | static_cast<uint16_t>(rhs));
     }
     inline Properties& operator |= (Properties& lhs, Properties rhs) {
         lhs = lhs | rhs;
         return lhs;
     }
-    inline Properties operator & (Properties lhs, Properties rhs) {
+    constexpr Properties operator & (Properties lhs, Properties rhs) {
         return static_cast<Properties>(static_cast<uint16_t>(lhs) & static_cast<uint16_t>(rhs));
     }
 
+    // One row of a service's GATT layout. A service is declared as a constexpr
+    // array of these, the service row first and then its characteristics in the
+    // order they are added, so the layout lives in flash and every ATT handle is
+    // known at compile time. The manager checks the runtime objects and the
+    // handles btstack hands out against it while registering.
+    struct GattEntry {
+        enum class Kind: uint8_t {
+            Service,
+            Characteristic
+        };
+
+        static constexpr GattEntry service(UUID type) {
+            return GattEntry(Kind::Service, type, Properties::None);
+        }
+        static constexpr GattEntry characteristic(UUID type, Properties properties) {
+            return GattEntry(Kind::Characteristic, type, properties);
+        }
+
+        constexpr bool hasClientConfiguration() const {
+            return static_cast<uint16_t>(properties & (Properties::Notify | Properties::Indicate));
+        }
+        // service declaration, or characteristic declaration + value (+ client configuration)
+        constexpr uint16_t handleCount() const {
+            return kind == Kind::Service ? 1 : (hasClientConfiguration() ? 3 : 2);
+        }
+
+        Kind kind;
+        UUID type;
+        Properties properties;
+
+    private:
+        constexpr GattEntry(Kind kind, UUID type, Properties properties): kind(kind), type(type), properties(properties) {}
+    };
+
+    // number of ATT handles a service layout occupies
+    constexpr uint16_t handleCount(const GattEntry* schema, size_t size) {
+        return size == 0 ? 0 : schema[0].handleCount() + handleCount(schema + 1, size - 1);
+    }
+    template <size_t N>
+    constexpr uint16_t handleCount(const GattEntry (&schema)[N]) {
+        return handleCount(schema, N);
+    }
+
+    // how updates to a characteristic are queued while the ATT server is busy
+    enum class UpdatePolicy: uint8_t {
+        // only the latest value matters, a pending update is overwritten (battery level)
+        Coalesce,
+        // every update is an event and is delivered in order (button presses)
+        Ordered
+    };
+
+    // Non-owning view of an attribute value
+    struct Bytes {
+        Bytes(): data(nullptr), size(0) {}
+        Bytes(const uint8_t* data, uint16_t size): data(data), size(size) {}
+        // a whole array, name it rather than passing a braced list
+        template <size_t N>
+        Bytes(const uint8_t (&array)[N]): data(array), size(N) {}
+        // catches { 0, n }, which would otherwise be read as a null pointer and a size
+        Bytes(std::nullptr_t, uint16_t) = delete;
+
+        uint8_t operator[](uint16_t index) const { return data[index]; }
+
+        const uint8_t* data;
+        uint16_t size;
+    };
+
+    // Attribute value storage with a compile-time maximum length. Lives inline
+    // in its attribute, so values never touch the heap and updates are a memcpy.
+    template <uint16_t N>
+    class Value {
+    public:
+        Value(Bytes initial) {
+            set(initial);
+        }
+
+        Bytes get() const { return Bytes(storage, length); }
+        bool set(Bytes newValue) {
+            if (newValue.size > N)
+                return false;
+            // an empty value may have no data at all, memcpy needs a valid pointer
+            if (newValue.size)
+                memcpy(storage, newValue.data, newValue.size);
+            length = newValue.size;
+            return true;
+        }
+
+    private:
+        uint8_t storage[N];
+        uint16_t length = 0;
+    };
+
+    class Manager;
     class Characteristic;
     class Descriptor {
         friend class Manager;
@@ -77,8 +232,8 @@ namespace BLE {
 
     public:
         Descriptor(const UUID& type, Properties properties): type(type), properties(properties) {}
-        virtual const std::vector<uint8_t>& getValue() = 0;
-        virtual Error setValue(const std::vector<uint8_t>& newValue) = 0;
+        virtual Bytes getValue() const = 0;
+        virtual Error setValue(Bytes newValue) = 0;
 
         const UUID& getType() const { return type; }
         const Properties& getProperties() const { return properties; }
@@ -89,26 +244,32 @@ namespace BLE {
         std::weak_ptr<Characteristic> characteristic;
     };
 
-    // Read-only descriptor with a constant value
+    // Read-only descriptor with a constant value of up to N bytes
+    template <uint16_t N>
     class StaticDescriptor: public Descriptor {
     public:
-        StaticDescriptor(const UUID& type, const std::vector<uint8_t>& value): Descriptor(type, Properties::None), value(value) {
+        StaticDescriptor(const UUID& type, Bytes value): Descriptor(type, Properties::None), value(value) {
             this->properties |= Properties::Read;
         }
-        const std::vector<uint8_t>& getValue() override { return value; }
+        Bytes getValue() const override { return value.get(); }
+        Error setValue(Bytes newValue) override {
+            return Error::WriteNotPermitted;
+        }
 
     protected:
-        std::vector<uint8_t> value;
+        Value<N> value;
     };
 
-    // Read-write descriptor with a mutable value
-    class MutableDescriptor: public StaticDescriptor {
+    // Read-write descriptor with a mutable value of up to N bytes
+    template <uint16_t N>
+    class MutableDescriptor: public StaticDescriptor<N> {
     public:
-        MutableDescriptor(const UUID& type, const std::vector<uint8_t>& value): StaticDescriptor(type, value) {
+        MutableDescriptor(const UUID& type, Bytes value): StaticDescriptor<N>(type, value) {
             this->properties |= Properties::Read | Properties::Write | Properties::Dynamic;
         }
-        Error setValue(const std::vector<uint8_t>& newValue) override {
-            value = newValue;
+        Error setValue(Bytes newValue) override {
+            if (!this->value.set(newValue))
+                return Error::InvalidAttributeValueLength;
             return Error::OK;
         }
     };
@@ -121,12 +282,19 @@ namespace BLE {
 
         void addDescriptor(std::shared_ptr<Descriptor> descriptor);
 
-        virtual const std::vector<uint8_t>& getValue() const = 0;
-        virtual Error setValue(const std::vector<uint8_t>& newValue) = 0;
+        virtual Bytes getValue() const = 0;
+        virtual Error setValue(Bytes newValue) = 0;
+
+        // queue the current value for the subscribed client, if it asked for them
+        void sendIndicate();
+        void sendNotify();
+        // whether the client enabled notifications or indications
+        bool isSubscribed() const;
 
         const UUID& getType() const { return type; }
         const Properties& getProperties() const { return properties; }
         const std::vector<std::shared_ptr<Descriptor>>& getDescriptors() const { return descriptors; }
+        UpdatePolicy getUpdatePolicy() const { return updatePolicy; }
 
         bool isDynamic() const {
             return static_cast<uint16_t>(getProperties() & Properties::Dynamic);
@@ -143,78 +311,144 @@ namespace BLE {
         Properties properties;
         std::vector<std::shared_ptr<Descriptor>> descriptors;
         std::shared_ptr<Descriptor> clientConfigurationDescriptor;
+        UpdatePolicy updatePolicy = UpdatePolicy::Coalesce;
 
         uint16_t handle = -1;
+        Manager* manager = nullptr;
     };
 
-    // Read-only characteristic with a constant value
+    // Read-only characteristic with a constant value of up to N bytes
+    template <uint16_t N>
     class StaticCharacteristic: public Characteristic {
     public:
-        StaticCharacteristic(const UUID& type, const std::vector<uint8_t>& value, const Properties& properties = Properties::None)
+        StaticCharacteristic(const UUID& type, Bytes value, const Properties& properties = Properties::None)
             : Characteristic(type, properties | Properties::Read), value(value) {}
 
-        const std::vector<uint8_t>& getValue() const override { return value; }
+        Bytes getValue() const override { return value.get(); }
 
-        Error setValue(const std::vector<uint8_t>& newValue) override {
+        Error setValue(Bytes newValue) override {
             // SHOULD NEVER HAPPEN!
             Serial.println("onWrite callback called for static characteristic!!");
             return Error::UnlikelyError;
         }
 
     protected:
-        std::vector<uint8_t> value;
+        Value<N> value;
     };
 
-    // Read-write characteristic with a mutable value
-    class MutableCharacteristic: public StaticCharacteristic {
+    // Read-write characteristic with a mutable value of up to N bytes
+    template <uint16_t N>
+    class MutableCharacteristic: public StaticCharacteristic<N> {
     public:
-        MutableCharacteristic(const UUID& type, const std::vector<uint8_t>& value, const Properties& properties = Properties::None)
-            : StaticCharacteristic(type, value, properties | Properties::Write | Properties::Dynamic) {}
+        MutableCharacteristic(const UUID& type, Bytes value, const Properties& properties = Properties::None)
+            : StaticCharacteristic<N>(type, value, properties | Properties::Write | Properties::Dynamic) {}
 
-        Error setValue(const std::vector<uint8_t>& newValue) override {
-            value = newValue;
+        Error setValue(Bytes newValue) override {
+            if (!this->value.set(newValue))
+                return Error::InvalidAttributeValueLength;
             return Error::OK;
         }
     };
 
-    // Indicatable characteristic
-    class IndicateCharacteristic: public StaticCharacteristic {
+    // Indicatable characteristic with a value of up to N bytes
+    template <uint16_t N>
+    class IndicateCharacteristic: public StaticCharacteristic<N> {
     public:
-        IndicateCharacteristic(const UUID& type, const std::vector<uint8_t>& value, const Properties& properties = Properties::None)
-            : StaticCharacteristic(type, value, properties | Properties::Indicate) {}
-        void sendIndicate();
+        IndicateCharacteristic(const UUID& type, Bytes value, const Properties& properties = Properties::None, UpdatePolicy updatePolicy = UpdatePolicy::Coalesce)
+            : StaticCharacteristic<N>(type, value, properties | Properties::Indicate) {
+            this->updatePolicy = updatePolicy;
+        }
 
-        Error setValue(const std::vector<uint8_t>& newValue) override {
-            value = newValue;
-            sendIndicate();
+        Error setValue(Bytes newValue) override {
+            if (!this->value.set(newValue))
+                return Error::InvalidAttributeValueLength;
+            this->sendIndicate();
             return Error::OK;
         }
     };
 
-    // Notifiable characteristic
-    class NotifyCharacteristic: public StaticCharacteristic {
+    // Notifiable characteristic with a value of up to N bytes
+    template <uint16_t N>
+    class NotifyCharacteristic: public StaticCharacteristic<N> {
     public:
-        NotifyCharacteristic(const UUID& type, const std::vector<uint8_t>& value, const Properties& properties = Properties::None)
-            : StaticCharacteristic(type, value, properties | Properties::Notify) {}
-        void sendNotify();
+        NotifyCharacteristic(const UUID& type, Bytes value, const Properties& properties = Properties::None, UpdatePolicy updatePolicy = UpdatePolicy::Coalesce)
+            : StaticCharacteristic<N>(type, value, properties | Properties::Notify) {
+            this->updatePolicy = updatePolicy;
+        }
 
-        Error setValue(const std::vector<uint8_t>& newValue) override {
-            value = newValue;
-            sendNotify();
+        Error setValue(Bytes newValue) override {
+            if (!this->value.set(newValue))
+                return Error::InvalidAttributeValueLength;
+            this->sendNotify();
             return Error::OK;
         }
     };
 
+    // Connection parameters, in the units the controller uses
+    struct ConnectionParameters {
+        // 1.25 ms
+        uint16_t minInterval;
+        uint16_t maxInterval;
+        // connection events the peripheral may skip when it has nothing to send
+        uint16_t slaveLatency;
+        // 10 ms
+        uint16_t supervisionTimeout;
+    };
+
+    // What the manager asks the central for. Slave latency doesn't delay anything
+    // the peripheral sends, so idle costs little: a press goes out within one idle
+    // interval, and switches to the active parameters for the presses that follow.
+    // The defaults follow Apple's accessory guidelines.
+    struct ConnectionPolicy {
+        // 15-30 ms
+        ConnectionParameters active = { 12, 24, 0, 400 };
+        // 100-150 ms, radio up every ~600 ms
+        ConnectionParameters idle = { 80, 120, 4, 400 };
+        // how long after the last activity to relax
+        system_tick_t idleAfter = 5000;
+    };
+
+    struct AdvertisingStep {
+        // how long after advertising (re)starts this step ends, ms
+        system_tick_t until;
+        // 0.625 ms
+        uint16_t interval;
+    };
+
+    // Advertising gets slower the longer nobody connects, so a parked car isn't
+    // paying for a fast interval all night. It starts over after a disconnect and
+    // when the manager is woken, e.g. by the bus coming alive.
+    // The default intervals are the ones Apple recommends.
+    struct AdvertisingSchedule {
+        static constexpr size_t MAX_STEPS = 4;
+        AdvertisingStep steps[MAX_STEPS] = {
+            // 20 ms for the first 30 s
+            { 30000, 32 },
+            // 152.5 ms for the next minute and a half
+            { 120000, 244 },
+            // 1022.5 ms from then on
+            { 0, 1636 }
+        };
+        // the last step lasts forever
+        size_t stepCount = 3;
+    };
+
     class Service {
     public:
-        Service(UUID type);
+        // the schema has to outlive the service, declare it constexpr at namespace scope
+        template <size_t N>
+        Service(const GattEntry (&schema)[N]): Service(schema, N) {}
+        Service(const GattEntry* schema, size_t schemaSize);
         void addCharacteristic(std::shared_ptr<Characteristic> characteristic);
 
-        const UUID& getType() const { return type; }
+        const UUID& getType() const { return schema[0].type; }
+        const GattEntry* getSchema() const { return schema; }
+        size_t getSchemaSize() const { return schemaSize; }
         const std::vector<std::shared_ptr<Characteristic>>& getCharacteristics() const { return characteristics; }
 
     private:
-        UUID type;
+        const GattEntry* schema;
+        size_t schemaSize;
         std::vector<std::shared_ptr<Characteristic>> characteristics;
         //TODO: do we need secondary services?
         //std::vector<Service> includedServices;
@@ -222,10 +456,57 @@ namespace BLE {
 
     class Manager {
     public:
+        struct QueueStatistics {
+            uint32_t enqueued = 0;
+            uint32_t coalesced = 0;
+            uint32_t dropped = 0;
+            uint32_t sent = 0;
+            size_t highWaterMark = 0;
+        };
+
+        // the wrapper doesn't report the interval the central picked. how long updates
+        // wait in the queue shows it instead: an indication holds up the next one until
+        // it is confirmed, one to two connection intervals later
+        struct ConnectionStatistics {
+            bool active = false;
+            uint32_t updatesRequested = 0;
+            uint32_t updatesRefused = 0;
+            uint32_t lastQueueDelay = 0;
+            uint32_t maxQueueDelay = 0;
+        };
+
         Manager();
         ~Manager();
 
-        void addService(std::shared_ptr<Service> service);
+        // registers the service with btstack, refuses it if it does not match its schema
+        bool addService(std::shared_ptr<Service> service);
+
+        // enough for every service's handleCount(), static_assert against it
+        static constexpr uint16_t MAX_HANDLES = 48;
+
+        // queues the characteristic's current value, it is sent as soon as the ATT server can take it
+        bool enqueueUpdate(const Characteristic& characteristic, bool indicate);
+        // sends queued updates until the ATT server is busy, call every loop
+        void process();
+        // updates the ATT server hasn't taken yet, process() needs calling again soon
+        bool hasPendingUpdates() const { return pendingCount > 0; }
+        const QueueStatistics& getQueueStatistics() const { return queueStatistics; }
+
+        // something latency sensitive happened, keeps the connection fast for a while
+        void noteActivity();
+        void setConnectionPolicy(const ConnectionPolicy& policy);
+        const ConnectionPolicy& getConnectionPolicy() const { return connectionPolicy; }
+        // queue delays in microseconds
+        const ConnectionStatistics& getConnectionStatistics() const { return connectionStatistics; }
+        // free places in the update queue, bulk senders should leave some for events
+        size_t availableUpdateSlots() const { return UPDATE_QUEUE_CAPACITY - pendingCount; }
+
+        // the MTU every client supports. the btstack wrapper answers the client's MTU
+        // exchange itself and neither reports the result nor passes read offsets on,
+        // so a larger MTU can't be used: updates and dynamic values stay within this
+        static constexpr uint16_t DEFAULT_MTU = 23;
+        // longest value an update can carry
+        static constexpr size_t MAX_UPDATE_LENGTH = DEFAULT_MTU - 3;
 
         void setAdvertisingParameters(advParams_t* advertisingParameters);
         //TODO: make wrapper around advertisement data
@@ -233,26 +514,100 @@ namespace BLE {
         //TODO: make wrapper around scan response data
         void setScanResponseData(std::vector<uint8_t>& scanResponseData);
 
+        // advertises following the schedule whenever disconnected
         void startAdvertising();
         void stopAdvertising();
+        // back to the fastest step, something suggests a phone is about to look for us
+        void wakeAdvertising();
+        void setAdvertisingSchedule(const AdvertisingSchedule& schedule);
+        const AdvertisingSchedule& getAdvertisingSchedule() const { return advertisingSchedule; }
+        // 0.625 ms, the interval currently advertised at
+        uint16_t getAdvertisingInterval() const { return advertisingParameters.adv_int_min; }
 
         //TODO: do this in a cleaner way
-        std::shared_ptr<IndicateCharacteristic> serviceChangedCharacteristic;
+        std::shared_ptr<Characteristic> serviceChangedCharacteristic;
 
         bool isConnected() {
             return connected;
         }
 
+        // called from btstack's thread after a connect, disconnect or write,
+        // so a sleeping loop() can react
+        typedef void (*EventHandler)();
+        void onEvent(EventHandler handler) { eventHandler = handler; }
+
     private:
         uint16_t onReadCallback(uint16_t handle, uint8_t* buffer, uint16_t bufferSize);
         int onWriteCallback(uint16_t handle, uint8_t* buffer, uint16_t bufferSize);
         void onConnectedCallback(BLEStatus_t status, uint16_t handle);
         void onDisconnectedCallback(uint16_t handle);
+        void notifyEvent();
+        void discardStaleUpdates();
+        uint16_t readValue(uint16_t handle, Bytes value, uint8_t* buffer, uint16_t bufferSize);
+        void resetConnectionState();
+        void updateConnectionParameters();
+        void updateAdvertising();
+        void applyAdvertisingStep(size_t step);
+
+        // what lives at an ATT handle, at most one of the two is set.
+        // owned through services, so plain pointers are enough
+        struct Attribute {
+            Characteristic* characteristic = nullptr;
+            Descriptor* descriptor = nullptr;
+        };
+        // ATT handles are small and dense, so attributes are indexed by handle directly
+        Attribute attributeFor(uint16_t handle) const {
+            return handle < MAX_HANDLES ? attributes[handle] : Attribute();
+        }
+        bool matchesSchema(const Service& service) const;
 
         std::vector<std::shared_ptr<Service>> services;
-        std::map<uint16_t, std::shared_ptr<Characteristic>> characteristicHandles;
-        std::map<uint16_t, std::shared_ptr<Descriptor>> descriptorHandles;
+        Attribute attributes[MAX_HANDLES];
+        // btstack hands out handles in order, starting at 1
+        uint16_t nextHandle = 1;
+
+        static constexpr size_t UPDATE_QUEUE_CAPACITY = 16;
+
+        struct PendingUpdate {
+            uint16_t handle;
+            bool indicate;
+            uint8_t length;
+            // micros() when first queued
+            uint32_t queuedAt;
+            uint8_t data[MAX_UPDATE_LENGTH];
+        };
+
+        // ring buffer, only touched from the application thread. btstack's callbacks
+        // run on its own thread and leave their part to process() through the flags below
+        PendingUpdate pendingUpdates[UPDATE_QUEUE_CAPACITY];
+        size_t pendingHead = 0;
+        size_t pendingCount = 0;
+        QueueStatistics queueStatistics;
+        // set on disconnect, the queue is emptied on the next process()
+        volatile bool discardPendingUpdates = false;
+        // set on connect, the service changed indication is queued on the next process()
+        volatile bool serviceChangedPending = false;
+
+        AdvertisingSchedule advertisingSchedule;
+        advParams_t advertisingParameters = {};
+        // whether advertising is wanted while disconnected
+        bool advertising = false;
+        system_tick_t advertisingStarted = 0;
+        // set to NO_STEP to have process() start the schedule over
+        volatile size_t advertisingStep = NO_STEP;
+        static constexpr size_t NO_STEP = (size_t)-1;
+
+        ConnectionPolicy connectionPolicy;
+        ConnectionStatistics connectionStatistics;
+        hci_con_handle_t connectionHandle = 0;
+        system_tick_t lastActivity = 0;
+        system_tick_t lastParameterRequest = 0;
+        // cleared when the policy or connection changes, to request again
+        bool parametersRequested = false;
+        // centrals answer requests with their own timing, don't flood them
+        static constexpr system_tick_t PARAMETER_REQUEST_INTERVAL = 1000;
 
         bool connected;
+        EventHandler eventHandler = nullptr;
     };
 }
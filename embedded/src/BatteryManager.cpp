@@ -17,15 +17,62 @@ void BatteryManager::enableBatteryReadings() {
     pinMode(CarloopRevision2::BATTERY_PIN, INPUT);
 }
 
-float BatteryManager::readBattery() {
+float BatteryManager::toVolts(float adcValue) {
     static constexpr auto MAX_ANALOG_VALUE = 4096;
     static constexpr auto MAX_ANALOG_VOLTAGE = 3.3f;
-    auto adcValue = analogRead(CarloopRevision2::BATTERY_PIN);
     return adcValue * MAX_ANALOG_VOLTAGE / MAX_ANALOG_VALUE * CarloopRevision2::BATTERY_FACTOR;
 }
 
+void BatteryManager::sample() {
+    // insertion sorted as they come in, the burst is tiny
+    int32_t samples[BURST_SIZE];
+    for (size_t i = 0; i < BURST_SIZE; i++) {
+        int32_t value = analogRead(CarloopRevision2::BATTERY_PIN);
+        size_t j = i;
+        for (; j > 0 && samples[j - 1] > value; j--)
+            samples[j] = samples[j - 1];
+        samples[j] = value;
+    }
+
+    // mean of the middle, spikes from injectors and the starter fall off the ends
+    int32_t sum = 0;
+    for (size_t i = BURST_TRIM; i < BURST_SIZE - BURST_TRIM; i++)
+        sum += samples[i];
+    float voltage = toVolts((float)sum / (BURST_SIZE - 2 * BURST_TRIM));
+    float low = toVolts(samples[BURST_TRIM]);
+    float high = toVolts(samples[BURST_SIZE - BURST_TRIM - 1]);
+
+    if (bursts == 0) {
+        reading.voltage = voltage;
+        reading.minimum = low;
+        reading.maximum = high;
+        reading.ripple = high - low;
+    } else {
+        reading.voltage += (voltage - reading.voltage) * FILTER_WEIGHT;
+    }
+
+    if (bursts % WINDOW_BURSTS == 0) {
+        windowMinimum = low;
+        windowMaximum = high;
+    } else {
+        windowMinimum = low < windowMinimum ? low : windowMinimum;
+        windowMaximum = high > windowMaximum ? high : windowMaximum;
+    }
+    bursts++;
+
+    if (bursts % WINDOW_BURSTS == 0) {
+        reading.minimum = windowMinimum;
+        reading.maximum = windowMaximum;
+        reading.ripple = windowMaximum - windowMinimum;
+    }
+}
+
 void BatteryManager::sleepIfLowBattery() {
-    float battery = readBattery();
+    // a couple of seconds after boot the filter is still catching up
+    if (!isSettled())
+        return;
+
+    float battery = reading.voltage;
     if (battery > IS_VEHICLE_BATTERY_THRESHOLD && battery < IS_VEHICLE_OFF_THRESHOLD) {
         // sleep indefinitely (seconds=0)
         // wake up when a rising edge signal is applied to the WKP pin or the reset button is pressed
@@ -1,18 +1,57 @@
 #pragma once
 
+#include "application.h"
+
+// Samples the vehicle battery through the carloop's divider. A single ADC read
+// is noisy enough to cross the sleep threshold by itself, so readings come
+// from bursts: each one is sorted, trimmed of its outliers and averaged, then
+// fed through a first order low pass filter.
 class BatteryManager {
 public:
+    // volts
+    struct Reading {
+        // filtered, what thresholds are checked against
+        float voltage = 0;
+        // extremes of the samples kept over the last window
+        float minimum = 0;
+        float maximum = 0;
+        // maximum - minimum, alternator ripple and load steps show up here
+        float ripple = 0;
+    };
+
     BatteryManager() {}
 
     void setup();
-    float readBattery();
+    // takes a burst of samples and folds it into the filter, call every SAMPLE_INTERVAL
+    void sample();
+    const Reading& getReading() const { return reading; }
+    // enough bursts through the filter to act on or report
+    bool isSettled() const { return bursts >= SETTLE_BURSTS; }
     // puts the device to sleep if vehicle is off
     void sleepIfLowBattery();
 
+    static constexpr system_tick_t SAMPLE_INTERVAL = 250;
+
 private:
     void disableCarloop();
     void enableBatteryReadings();
+    static float toVolts(float adcValue);
+
+    Reading reading;
+    uint32_t bursts = 0;
+    float windowMinimum = 0;
+    float windowMaximum = 0;
 
     static constexpr float IS_VEHICLE_OFF_THRESHOLD = 13.75f;
     static constexpr float IS_VEHICLE_BATTERY_THRESHOLD = 10.00f;
+
+    static constexpr size_t BURST_SIZE = 9;
+    // dropped from each end of the sorted burst
+    static constexpr size_t BURST_TRIM = 2;
+    // weight of each new burst, a time constant of about a second
+    static constexpr float FILTER_WEIGHT = 0.25f;
+    // bursts per published minimum and maximum
+    static constexpr uint32_t WINDOW_BURSTS = 4;
+    // bursts before the filter has settled enough to act on
+    static constexpr uint32_t SETTLE_BURSTS = 8;
 };
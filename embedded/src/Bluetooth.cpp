@@ -5,16 +5,27 @@
 using namespace BLE;
 
 const uint16_t peripheralAppearance = BLE_APPEARANCE_UNKNOWN;
+const uint8_t appearanceValue[] = { LOW_BYTE(peripheralAppearance), HIGH_BYTE(peripheralAppearance) };
+// range from uint16(0x0000) to uint16(0xFFFF)
+const uint8_t serviceChangedValue[] = { 0x00, 0x00, 0xFF, 0xFF };
 
 // BLE peripheral preferred connection parameters:
 // - Minimum connection interval = MIN_CONN_INTERVAL * 1.25 ms, where MIN_CONN_INTERVAL ranges from 0x0006 to 0x0C80
 // - Maximum connection interval = MAX_CONN_INTERVAL * 1.25 ms,  where MAX_CONN_INTERVAL ranges from 0x0006 to 0x0C80
 // - The SLAVE_LATENCY ranges from 0x0000 to 0x03E8
 // - Connection supervision timeout = CONN_SUPERVISION_TIMEOUT * 10 ms, where CONN_SUPERVISION_TIMEOUT ranges from 0x000A to 0x0C80
-const uint16_t minConnectionInterval = 0x0028; // 50 ms
-const uint16_t maxConnectionInterval = 0x0190; // 500 ms
-const uint16_t slaveLatency = 0x0000; // no slave latency
-const uint16_t connectionSupervisionTimeout = 0x03E8; // 10 s
+// the idle parameters of the default policy, Manager asks for faster ones while active
+const ConnectionParameters preferredConnectionParameters = ConnectionPolicy().idle;
+const uint16_t minConnectionInterval = preferredConnectionParameters.minInterval; // 100 ms
+const uint16_t maxConnectionInterval = preferredConnectionParameters.maxInterval; // 150 ms
+const uint16_t slaveLatency = preferredConnectionParameters.slaveLatency; // 4 events
+const uint16_t connectionSupervisionTimeout = preferredConnectionParameters.supervisionTimeout; // 4 s
+const uint8_t preferredConnectionParametersValue[] = {
+    LOW_BYTE(minConnectionInterval), HIGH_BYTE(minConnectionInterval),
+    LOW_BYTE(maxConnectionInterval), HIGH_BYTE(maxConnectionInterval),
+    LOW_BYTE(slaveLatency), HIGH_BYTE(slaveLatency),
+    LOW_BYTE(connectionSupervisionTimeout), HIGH_BYTE(connectionSupervisionTimeout)
+};
 
 // BLE peripheral advertising parameters:
 // - advertising_interval_min: [0x0020, 0x4000], default: 0x0800, unit: 0.625 msec
@@ -37,8 +48,9 @@ const uint16_t connectionSupervisionTimeout = 0x03E8; // 10 s
 //       BLE_GAP_ADV_FP_FILTER_SCANREQ
 //       BLE_GAP_ADV_FP_FILTER_CONNREQ
 //       BLE_GAP_ADV_FP_FILTER_BOTH
-const uint16_t minAdvertisingInterval = 0x0030; // 30 ms
-const uint16_t maxAdvertisingInterval = 0x0030; // 30 ms
+// the interval is the first step of the advertising schedule, Manager slows it down from there
+const uint16_t minAdvertisingInterval = AdvertisingSchedule().steps[0].interval; // 20 ms
+const uint16_t maxAdvertisingInterval = minAdvertisingInterval;
 const uint8_t advertisingType = BLE_GAP_ADV_TYPE_ADV_IND; // fully open
 const uint8_t addressType = BLE_GAP_ADDR_TYPE_PUBLIC; // 3 byte company id, 3 byte device id
 const uint8_t address[BD_ADDR_LEN] = { 0x13, 0x33, 0x22, 0x00, 0x70, 0x07 }; // one 1, three 3, two 2 - double double o seven
@@ -60,49 +72,54 @@ static std::vector<uint8_t> advertisementData = {
     BLE_GAP_ADV_FLAGS_LE_ONLY_GENERAL_DISC_MODE, // never stops advertising, low energy only
     0x11, // len
     BLE_GAP_AD_TYPE_128BIT_SERVICE_UUID_MORE_AVAILABLE, // just one service, no room for more
-    // TODO: not hardcode this
-    0x16, 0x88, 0x7F, 0xD0, 0x6A, 0x40, 0x75, 0xB5, 0xD6, 0x40, 0x49, 0xEA, 0x1D, 0x8B, 0x7E, 0x9A // CAN service uuid
+    // advertised service uuid, filled in from the service's constant
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
 };
+const size_t advertisedServiceOffset = 5;
 static std::vector<uint8_t> scanResponseData = {
     0x06,
     BLE_GAP_AD_TYPE_COMPLETE_LOCAL_NAME,
     'B', 'o', 'o', 's', 't'
 };
 
-BLE::GapService::GapService(const std::string deviceName): Service(UUID(BLE_UUID_GAP)) {
-    addCharacteristic(std::make_shared<StaticCharacteristic>(
+BLE::GapService::GapService(const std::string deviceName): Service(gapServiceSchema) {
+    uint16_t nameLength = deviceName.size() < MAX_DEVICE_NAME_LENGTH ? deviceName.size() : MAX_DEVICE_NAME_LENGTH;
+    addCharacteristic(std::make_shared<StaticCharacteristic<MAX_DEVICE_NAME_LENGTH>>(
         UUID(BLE_UUID_GAP_CHARACTERISTIC_DEVICE_NAME),
-        std::vector<uint8_t>(deviceName.begin(), deviceName.end())));
-    addCharacteristic(std::make_shared<StaticCharacteristic>(
+        Bytes(reinterpret_cast<const uint8_t*>(deviceName.data()), nameLength)));
+    addCharacteristic(std::make_shared<StaticCharacteristic<2>>(
         UUID(BLE_UUID_GAP_CHARACTERISTIC_APPEARANCE),
-        std::vector<uint8_t>{ LOW_BYTE(peripheralAppearance), HIGH_BYTE(peripheralAppearance) }));
-    addCharacteristic(std::make_shared<StaticCharacteristic>(
+        Bytes(appearanceValue)));
+    addCharacteristic(std::make_shared<StaticCharacteristic<8>>(
         UUID(BLE_UUID_GAP_CHARACTERISTIC_PPCP),
-        std::vector<uint8_t>{
-            LOW_BYTE(minConnectionInterval), HIGH_BYTE(minConnectionInterval),
-            LOW_BYTE(maxConnectionInterval), HIGH_BYTE(maxConnectionInterval),
-            LOW_BYTE(slaveLatency), HIGH_BYTE(slaveLatency),
-            LOW_BYTE(connectionSupervisionTimeout), HIGH_BYTE(connectionSupervisionTimeout) }));
+        Bytes(preferredConnectionParametersValue)));
 }
 
-BLE::GattService::GattService(): Service(UUID(BLE_UUID_GATT)) {
-    this->serviceChangedCharacteristic = std::make_shared<IndicateCharacteristic>(
+BLE::GattService::GattService(): Service(gattServiceSchema) {
+    this->serviceChangedCharacteristic = std::make_shared<IndicateCharacteristic<4>>(
         UUID(BLE_UUID_GATT_CHARACTERISTIC_SERVICE_CHANGED),
-        std::vector<uint8_t>{ 0x00, 0x00, 0xFF, 0xFF }); // range from uint16(0x0000) to uint16(0xFFFF)
+        Bytes(serviceChangedValue));
     addCharacteristic(this->serviceChangedCharacteristic);
 }
 
-std::unique_ptr<BLE::Manager> BLE::bluetooth() {
+std::unique_ptr<BLE::Manager> BLE::bluetooth(const UUID& advertisedService) {
     std::unique_ptr<Manager> manager(new Manager);
 
+    // uuids are advertised little endian
+    for (size_t i = 0; i < 16; i++) {
+        advertisementData[advertisedServiceOffset + i] = advertisedService.littleEndian(i);
+    }
+
     manager->setAdvertisingParameters(&advertisingParameters);
     manager->setAdvertisementData(advertisementData);
     manager->setScanResponseData(scanResponseData);
 
-    manager->addService(std::make_shared<GapService>("Boost"));
+    if (!manager->addService(std::make_shared<GapService>("Boost")))
+        return nullptr;
 
     std::shared_ptr<GattService> gattService = std::make_shared<GattService>();
-    manager->addService(gattService);
+    if (!manager->addService(gattService))
+        return nullptr;
 
     manager->serviceChangedCharacteristic = gattService->serviceChangedCharacteristic;
 
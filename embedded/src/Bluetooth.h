@@ -6,16 +6,36 @@
 
 namespace BLE {
 
+    constexpr GattEntry gapServiceSchema[] = {
+        GattEntry::service(BLE_UUID_GAP),
+        GattEntry::characteristic(BLE_UUID_GAP_CHARACTERISTIC_DEVICE_NAME, Properties::Read),
+        GattEntry::characteristic(BLE_UUID_GAP_CHARACTERISTIC_APPEARANCE, Properties::Read),
+        GattEntry::characteristic(BLE_UUID_GAP_CHARACTERISTIC_PPCP, Properties::Read)
+    };
+
+    constexpr GattEntry gattServiceSchema[] = {
+        GattEntry::service(BLE_UUID_GATT),
+        GattEntry::characteristic(BLE_UUID_GATT_CHARACTERISTIC_SERVICE_CHANGED, Properties::Read | Properties::Indicate)
+    };
+
+    // handles taken by the services bluetooth() adds itself
+    constexpr uint16_t standardServiceHandleCount = handleCount(gapServiceSchema) + handleCount(gattServiceSchema);
+
     class GapService: public Service {
     public:
         GapService(const std::string deviceName);
+
+        // longer names are cut short, the device name is only a label
+        static constexpr uint16_t MAX_DEVICE_NAME_LENGTH = 20;
     };
 
     class GattService: public Service {
     public:
         GattService();
-        std::shared_ptr<IndicateCharacteristic> serviceChangedCharacteristic;
+        std::shared_ptr<IndicateCharacteristic<4>> serviceChangedCharacteristic;
     };
 
-    std::unique_ptr<BLE::Manager> bluetooth();
+    // advertisedService is the one service uuid that fits into the advertisement.
+    // null if the standard services don't fit the GATT table
+    std::unique_ptr<BLE::Manager> bluetooth(const UUID& advertisedService);
 }
@@ -0,0 +1,173 @@
+#include "CANDispatcher.h"
+
+bool CANDispatcher::on(uint32_t id, Handler handler, bool extended) {
+    if (!handler || handlerCount >= MAX_HANDLERS) {
+        Serial.printlnf("Cannot register CAN handler for id: %x", id);
+        return false;
+    }
+
+    uint32_t key = keyFor(id, extended);
+    for (size_t slot = slotFor(key); ; slot = (slot + 1) % TABLE_SIZE) {
+        Entry& entry = table[slot];
+        if (entry.handler && entry.key == key) {
+            Serial.printlnf("CAN handler already registered for id: %x", id);
+            return false;
+        }
+        if (!entry.handler) {
+            entry.key = key;
+            entry.handler = handler;
+            handlerCount++;
+            return true;
+        }
+    }
+}
+
+bool CANDispatcher::on(uint32_t id, uint32_t mask, Handler handler, bool extended) {
+    if (!handler || maskedHandlerCount >= MAX_MASKED_HANDLERS) {
+        Serial.printlnf("Cannot register CAN handler for id: %x mask: %x", id, mask);
+        return false;
+    }
+
+    // the extended flag always has to match
+    MaskedEntry& entry = maskedHandlers[maskedHandlerCount++];
+    entry.key = keyFor(id, extended);
+    entry.mask = (mask | EXTENDED_FLAG) & fullMaskFor(entry.key);
+    entry.key &= entry.mask;
+    entry.handler = handler;
+    return true;
+}
+
+bool CANDispatcher::dispatch(const CANFrame& frame) const {
+    uint32_t key = keyFor(frame.message.id, frame.message.extended);
+    bool handled = false;
+
+    // table is never full, so an empty slot always ends the probe
+    for (size_t slot = slotFor(key); table[slot].handler; slot = (slot + 1) % TABLE_SIZE) {
+        if (table[slot].key == key) {
+            table[slot].handler(frame);
+            handled = true;
+            break;
+        }
+    }
+
+    for (size_t i = 0; i < maskedHandlerCount; i++) {
+        const MaskedEntry& entry = maskedHandlers[i];
+        if ((key & entry.mask) == entry.key) {
+            entry.handler(frame);
+            handled = true;
+        }
+    }
+
+    return handled;
+}
+
+// filters are worked on as (key, mask) pairs so standard and extended ids never merge
+struct KeyFilter {
+    uint32_t key;
+    uint32_t mask;
+};
+
+// whether a accepts every frame b accepts
+static bool covers(const KeyFilter& a, const KeyFilter& b) {
+    return (a.mask & ~b.mask) == 0 && (b.key & a.mask) == a.key;
+}
+
+size_t CANDispatcher::computeFilters(Filter* filters, size_t maxFilters) const {
+    KeyFilter candidates[MAX_HANDLERS + MAX_MASKED_HANDLERS];
+    size_t count = 0;
+
+    for (const Entry& entry : table) {
+        if (entry.handler)
+            candidates[count++] = { entry.key, fullMaskFor(entry.key) };
+    }
+    for (size_t i = 0; i < maskedHandlerCount; i++) {
+        candidates[count++] = { maskedHandlers[i].key, maskedHandlers[i].mask };
+    }
+
+    // exact pass: merge pairs with the same mask that differ only in one id
+    // bit, lowest bit first so aligned id ranges collapse into a single filter,
+    // then drop filters covered by another one. Neither accepts any new ids.
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (uint32_t bit = 1; bit != EXTENDED_FLAG; bit <<= 1) {
+            for (size_t i = 0; i < count; i++) {
+                KeyFilter& a = candidates[i];
+                if (!(a.mask & bit))
+                    continue;
+
+                for (size_t j = i + 1; j < count; j++) {
+                    const KeyFilter& b = candidates[j];
+                    if (a.mask == b.mask && (a.key ^ b.key) == bit) {
+                        a.mask &= ~bit;
+                        a.key &= a.mask;
+                        candidates[j] = candidates[--count];
+                        changed = true;
+                        break;
+                    }
+                }
+            }
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            for (size_t j = 0; j < count; j++) {
+                if (i != j && covers(candidates[j], candidates[i])) {
+                    candidates[i--] = candidates[--count];
+                    changed = true;
+                    break;
+                }
+            }
+        }
+    }
+
+    // lossy pass: out of filter banks, so merge whichever pair keeps the most
+    // id bits significant. Dispatch still discards the extra frames in software.
+    while (count > maxFilters && count > 1) {
+        size_t bestI = 0;
+        size_t bestJ = 1;
+        int bestBits = -1;
+        for (size_t i = 0; i < count; i++) {
+            for (size_t j = i + 1; j < count; j++) {
+                const KeyFilter& a = candidates[i];
+                const KeyFilter& b = candidates[j];
+                int bits = __builtin_popcount(a.mask & b.mask & ~(a.key ^ b.key));
+                if (bits > bestBits) {
+                    bestBits = bits;
+                    bestI = i;
+                    bestJ = j;
+                }
+            }
+        }
+
+        KeyFilter& a = candidates[bestI];
+        const KeyFilter& b = candidates[bestJ];
+        a.mask &= b.mask & ~(a.key ^ b.key);
+        a.key &= a.mask;
+        candidates[bestJ] = candidates[--count];
+    }
+
+    if (count > maxFilters)
+        count = maxFilters;
+
+    for (size_t i = 0; i < count; i++) {
+        filters[i].extended = candidates[i].key & EXTENDED_FLAG;
+        filters[i].id = candidates[i].key & ~EXTENDED_FLAG;
+        filters[i].mask = candidates[i].mask & ~EXTENDED_FLAG;
+    }
+    return count;
+}
+
+void CANDispatcher::applyFilters(CANChannel& can) const {
+    Filter filters[MAX_FILTERS];
+    size_t count = computeFilters(filters, MAX_FILTERS);
+
+    can.clearFilters();
+    for (size_t i = 0; i < count; i++) {
+        const Filter& filter = filters[i];
+        bool added = can.addFilter(
+            filter.id,
+            filter.mask,
+            filter.extended ? CAN_FILTER_EXTENDED : CAN_FILTER_STANDARD);
+        Serial.printlnf("Added CAN filter id: %x mask: %x, ok: %d", filter.id, filter.mask, added);
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include "application.h"
+#include "CANFrame.h"
+
+// Routes received CAN frames to the handlers registered for their id.
+// Exact ids live in a fixed open-addressing hash table, so dispatch cost does
+// not grow with the number of handlers. Id/mask handlers are scanned linearly
+// and should be kept to a handful. Register everything during setup().
+class CANDispatcher {
+public:
+    typedef void (*Handler)(const CANFrame& frame);
+
+    // hardware acceptance filter, a frame passes if (frame id & mask) == (id & mask)
+    struct Filter {
+        uint32_t id;
+        uint32_t mask;
+        bool extended;
+    };
+
+    // handles frames with exactly this id
+    bool on(uint32_t id, Handler handler, bool extended = false);
+    // handles frames where (frame id & mask) == (id & mask)
+    bool on(uint32_t id, uint32_t mask, Handler handler, bool extended = false);
+
+    // calls every matching handler, returns whether there was one
+    bool dispatch(const CANFrame& frame) const;
+
+    // smallest set of filters that accepts exactly the registered ids, widened
+    // only if more than maxFilters would be needed. Returns the filter count.
+    size_t computeFilters(Filter* filters, size_t maxFilters) const;
+    // programs the filters into the controller so unhandled frames never reach us,
+    // call before can.begin()
+    void applyFilters(CANChannel& can) const;
+
+    static constexpr size_t MAX_HANDLERS = 128;
+    static constexpr size_t MAX_MASKED_HANDLERS = 8;
+    // filter banks available to the second CAN controller
+    static constexpr size_t MAX_FILTERS = 14;
+
+private:
+    struct Entry {
+        uint32_t key;
+        Handler handler;
+    };
+    struct MaskedEntry {
+        uint32_t key;
+        uint32_t mask;
+        Handler handler;
+    };
+
+    static uint32_t keyFor(uint32_t id, bool extended) {
+        return extended ? (id | EXTENDED_FLAG) : id;
+    }
+    // every id bit plus the extended flag
+    static uint32_t fullMaskFor(uint32_t key) {
+        return (key & EXTENDED_FLAG) ? (EXTENDED_ID_MASK | EXTENDED_FLAG) : (STANDARD_ID_MASK | EXTENDED_FLAG);
+    }
+    static size_t slotFor(uint32_t key) {
+        // fibonacci hashing, ids on the bus tend to be clustered
+        return (key * 2654435769u) >> (32 - TABLE_BITS);
+    }
+
+    static constexpr uint32_t EXTENDED_FLAG = 0x80000000;
+    static constexpr uint32_t STANDARD_ID_MASK = 0x7FF;
+    static constexpr uint32_t EXTENDED_ID_MASK = 0x1FFFFFFF;
+    // table is kept at most half full so probes stay short
+    static constexpr size_t TABLE_BITS = 8;
+    static constexpr size_t TABLE_SIZE = 1 << TABLE_BITS;
+    static_assert(TABLE_SIZE >= MAX_HANDLERS * 2, "dispatch table too small");
+
+    // slots without a handler are empty
+    Entry table[TABLE_SIZE] = {};
+    size_t handlerCount = 0;
+    MaskedEntry maskedHandlers[MAX_MASKED_HANDLERS] = {};
+    size_t maskedHandlerCount = 0;
+};
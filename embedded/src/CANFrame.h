@@ -0,0 +1,13 @@
+#pragma once
+
+#include "application.h"
+
+// A received frame and when it arrived
+struct CANFrame {
+    CANMessage message;
+    // micros() when the frame was taken off the controller
+    uint32_t timestamp;
+    // millis() at the same moment. micros() wraps every 71.6 minutes, which isn't
+    // a whole number of minutes, so this is what lawicel timestamps are taken from
+    uint32_t milliseconds;
+};
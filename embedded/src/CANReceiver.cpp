@@ -0,0 +1,39 @@
+#include "CANReceiver.h"
+
+void CANReceiver::begin() {
+    if (thread)
+        return;
+
+    // above the application thread, so a busy loop() never delays a frame
+    thread = new Thread("can", run, this, OS_THREAD_PRIORITY_DEFAULT + 1);
+}
+
+os_thread_return_t CANReceiver::run(void* receiver) {
+    CANReceiver& self = *static_cast<CANReceiver*>(receiver);
+    CANFrame frame;
+    system_tick_t lastFrameTime = 0;
+
+    while (true) {
+        self.polls++;
+        bool received = false;
+        while (self.can.receive(frame.message)) {
+            // micros() runs off the cycle counter, the error is how long the frame sat
+            // in the controller's queue: at most one poll interval
+            frame.timestamp = micros();
+            frame.milliseconds = millis();
+            // a full queue counts an overflow, the frame is lost either way
+            self.frames.push(frame);
+            received = true;
+        }
+
+        system_tick_t now = millis();
+        if (received) {
+            lastFrameTime = now;
+            if (self.receiveHandler)
+                self.receiveHandler();
+        }
+
+        bool quiet = self.quietPollingAllowed && now - lastFrameTime >= QUIET_AFTER;
+        delay(quiet ? QUIET_POLL_INTERVAL : POLL_INTERVAL);
+    }
+}
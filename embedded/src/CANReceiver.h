@@ -0,0 +1,62 @@
+#pragma once
+
+#include "application.h"
+#include "CANFrame.h"
+#include "RingBuffer.h"
+
+// Drains the CAN controller from its own thread into a lock-free ring buffer,
+// so frames are timestamped on arrival and none are lost while loop() is busy
+// blinking, sleeping or writing to serial. loop() is the only consumer.
+class CANReceiver {
+public:
+    // called from the receive thread after new frames are queued
+    typedef void (*ReceiveHandler)();
+
+    CANReceiver(CANChannel& can): can(can) {}
+
+    // starts the receive thread, call once after can.begin()
+    void begin();
+    // lets a sleeping loop() know there is work, set before begin()
+    void onReceive(ReceiveHandler handler) { receiveHandler = handler; }
+
+    // consumer side, returns false when no frame is waiting
+    bool receive(CANFrame& frame) { return frames.pop(frame); }
+    // frames queued and not yet received
+    size_t pending() const { return frames.size(); }
+
+    // lets the receive thread poll a quiet bus every QUIET_POLL_INTERVAL instead of
+    // every POLL_INTERVAL, which delays the frame that ends the quiet. only for when
+    // nothing needs frames promptly, e.g. no phone is connected or its connection has
+    // relaxed to a long interval anyway. safe from any thread
+    void allowQuietPolling(bool allowed) { quietPollingAllowed = allowed; }
+    // times the receive thread has woken to poll the controller, wraps around
+    uint32_t getPolls() const { return polls; }
+
+    uint32_t getOverflows() const { return frames.getOverflows(); }
+    size_t getHighWaterMark() const { return frames.getHighWaterMark(); }
+    static constexpr size_t capacity() { return QUEUE_SIZE; }
+
+private:
+    static os_thread_return_t run(void* receiver);
+
+    CANChannel& can;
+    Thread* thread = nullptr;
+    ReceiveHandler receiveHandler = nullptr;
+
+    // a full second of steering wheel traffic, plus headroom
+    static constexpr size_t QUEUE_SIZE = 64;
+    // the controller's own queue holds 32 frames, polling every millisecond keeps
+    // well ahead of a 33.3 kbit bus (~300 frames/s) and a 500 kbit one (~4000 frames/s)
+    static constexpr system_tick_t POLL_INTERVAL = 1;
+    // a quiet bus is polled less often so the core can idle. the frame that wakes
+    // it is timestamped up to this late, 32 frames last longer than this at 500 kbit.
+    // with the acceptance filters on the bus nearly always looks quiet, so this is
+    // only used while allowed
+    static constexpr system_tick_t QUIET_POLL_INTERVAL = 5;
+    static constexpr system_tick_t QUIET_AFTER = 100;
+
+    RingBuffer<CANFrame, QUEUE_SIZE> frames;
+    volatile bool quietPollingAllowed = false;
+    // written by the receive thread only
+    volatile uint32_t polls = 0;
+};
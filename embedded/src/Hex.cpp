@@ -0,0 +1,4 @@
+#include "Hex.h"
+
+constexpr uint8_t Hex::INVALID;
+constexpr uint8_t Hex::digitValues[256];
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "application.h"
+
+// Table driven hex codec shared by SLCAN and the UUID parser.
+// Decoding accumulates the table entries instead of branching per digit, so
+// an invalid digit anywhere is caught with one test at the end.
+class Hex {
+public:
+    // set in the table entry of anything that isn't a hex digit
+    static constexpr uint8_t INVALID = 0x10;
+
+    static constexpr uint8_t digitValue(char c) {
+        return digitValues[static_cast<uint8_t>(c)];
+    }
+
+    // `digits` characters, most significant first
+    static bool decode(const char *in, unsigned digits, uint32_t& value) {
+        uint8_t errors = 0;
+        uint32_t result = 0;
+        for (unsigned i = 0; i < digits; i++) {
+            uint8_t digit = digitValue(in[i]);
+            errors |= digit;
+            result = (result << 4) | (digit & 0xf);
+        }
+        value = result;
+        return !(errors & INVALID);
+    }
+
+    // two characters per byte
+    static bool decodeBytes(const char *in, uint8_t *out, size_t count) {
+        uint8_t errors = 0;
+        for (size_t i = 0; i < count; i++, in += 2) {
+            uint8_t high = digitValue(in[0]);
+            uint8_t low = digitValue(in[1]);
+            errors |= high | low;
+            out[i] = (high << 4) | (low & 0xf);
+        }
+        return !(errors & INVALID);
+    }
+
+    // low `digits` nibbles of value, most significant first. returns the end
+    static char *encode(char *out, uint32_t value, unsigned digits) {
+        for (unsigned i = digits; i > 0; i--) {
+            out[i - 1] = DIGITS[value & 0xf];
+            value >>= 4;
+        }
+        return out + digits;
+    }
+
+    static char *encodeBytes(char *out, const uint8_t *in, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            *out++ = DIGITS[in[i] >> 4];
+            *out++ = DIGITS[in[i] & 0xf];
+        }
+        return out;
+    }
+
+    static constexpr const char *DIGITS = "0123456789abcdef";
+
+private:
+    #define X INVALID
+    static constexpr uint8_t digitValues[256] = {
+        X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+        X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+        X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+        0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  X,  X,  X,  X,  X,  X,
+        X, 10, 11, 12, 13, 14, 15,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+        X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+        X, 10, 11, 12, 13, 14, 15,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+        X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+        X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+        X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+        X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+        X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+        X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+        X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+        X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,
+        X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X,  X
+    };
+    #undef X
+};
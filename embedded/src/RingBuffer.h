@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+// Lock-free single producer, single consumer queue holding up to N items.
+// push() may only be called from one thread (or interrupt) and pop() from one
+// other, no locks are taken on either side. N must be a power of two.
+template <typename T, size_t N>
+class RingBuffer {
+    static_assert(N && !(N & (N - 1)), "ring buffer size must be a power of two");
+
+public:
+    // producer side, returns false and counts an overflow when full
+    bool push(const T& item) {
+        size_t head = this->head.load(std::memory_order_relaxed);
+        size_t used = head - tail.load(std::memory_order_acquire);
+        if (used == N) {
+            overflows++;
+            return false;
+        }
+
+        items[head & (N - 1)] = item;
+        this->head.store(head + 1, std::memory_order_release);
+
+        if (used + 1 > highWaterMark)
+            highWaterMark = used + 1;
+        return true;
+    }
+
+    // consumer side, returns false when empty
+    bool pop(T& item) {
+        size_t tail = this->tail.load(std::memory_order_relaxed);
+        if (tail == head.load(std::memory_order_acquire))
+            return false;
+
+        item = items[tail & (N - 1)];
+        this->tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side, copies the oldest item without removing it
+    bool peek(T& item) const {
+        size_t tail = this->tail.load(std::memory_order_relaxed);
+        if (tail == head.load(std::memory_order_acquire))
+            return false;
+
+        item = items[tail & (N - 1)];
+        return true;
+    }
+
+    size_t size() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+    bool empty() const { return size() == 0; }
+    static constexpr size_t capacity() { return N; }
+
+    // written by the producer only, safe to read anywhere
+    uint32_t getOverflows() const { return overflows; }
+    size_t getHighWaterMark() const { return highWaterMark; }
+
+private:
+    T items[N];
+    // free running counters, the difference is the number of items queued
+    std::atomic<size_t> head { 0 };
+    std::atomic<size_t> tail { 0 };
+
+    volatile uint32_t overflows = 0;
+    volatile size_t highWaterMark = 0;
+};
@@ -1,79 +1,412 @@
 #include "SLCAN.h"
 
-void SLCAN::transmitMessage(const char *buf, unsigned n) {
-    if (!can.isEnabled())
-        return;
+// S0 through S8
+static const unsigned long standardBitrates[] = {
+    10000, 20000, 50000, 100000, 125000, 250000, 500000, 800000, 1000000
+};
+
+void SLCAN::printReceivedMessage(const CANFrame &frame) {
+    printReceivedMessages(&frame, 1);
+}
+
+void SLCAN::printReceivedMessages(const CANFrame *frames, size_t count) {
+    char buf[MAX_BATCH_LENGTH];
+    size_t n = 0;
+    // usb writes block once the buffer is full, which would stall BLE with it
+    int room = serial.availableForWrite();
+
+    for (size_t i = 0; i < count; i++) {
+        if (n + MAX_MESSAGE_LENGTH > sizeof(buf)) {
+            serial.write((const uint8_t *)buf, n);
+            room -= n;
+            n = 0;
+        }
+        if ((int)(n + MAX_MESSAGE_LENGTH) > room) {
+            overruns++;
+            continue;
+        }
+        n += formatReceivedMessage(frames[i], buf + n);
+    }
+
+    if (n > 0)
+        serial.write((const uint8_t *)buf, n);
+}
+
+// crc-16/ccitt-false, a nibble at a time
+static const uint16_t crcTable[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef
+};
+
+static uint16_t crc16(const uint8_t *data, size_t n) {
+    uint16_t crc = 0xffff;
+    for (size_t i = 0; i < n; i++) {
+        crc = (crc << 4) ^ crcTable[(crc >> 12) ^ (data[i] >> 4)];
+        crc = (crc << 4) ^ crcTable[(crc >> 12) ^ (data[i] & 0xf)];
+    }
+    return crc;
+}
+
+// consistent overhead byte stuffing, out needs n + n / 254 + 1 bytes.
+// afterwards 0 only appears as the packet delimiter
+static size_t cobsEncode(const uint8_t *in, size_t n, uint8_t *out) {
+    size_t codeIndex = 0;
+    size_t length = 1;
+    uint8_t code = 1;
+
+    for (size_t i = 0; i < n; i++) {
+        if (in[i] != 0) {
+            out[length++] = in[i];
+            code++;
+        }
+        if (in[i] == 0 || code == 0xff) {
+            out[codeIndex] = code;
+            codeIndex = length++;
+            code = 1;
+        }
+    }
+
+    out[codeIndex] = code;
+    return length;
+}
+
+// renders one frame, in text with its trailing '\r' or as a binary packet.
+// buf needs MAX_MESSAGE_LENGTH bytes
+size_t SLCAN::formatReceivedMessage(const CANFrame &frame, char *buf) {
+    if (binary)
+        return formatBinaryMessage(frame, buf);
 
-    if (n < 4)
+    const CANMessage &message = frame.message;
+    char *out = buf;
+
+    if (message.extended) {
+        *out++ = message.rtr ? 'R' : 'T';
+        out = Hex::encode(out, message.id, 8);
+    } else {
+        *out++ = message.rtr ? 'r' : 't';
+        out = Hex::encode(out, message.id, 3);
+    }
+
+    uint8_t len = message.len > 8 ? 8 : message.len;
+    *out++ = Hex::DIGITS[len];
+    if (!message.rtr)
+        out = Hex::encodeBytes(out, message.data, len);
+
+    if (timestamps) {
+        // lawicel timestamps are milliseconds wrapping every minute
+        out = Hex::encode(out, frame.milliseconds % 60000, 4);
+    }
+
+    *out++ = NEW_LINE;
+    return out - buf;
+}
+
+size_t SLCAN::formatBinaryMessage(const CANFrame &frame, char *buf) {
+    const CANMessage &message = frame.message;
+    uint8_t packet[MAX_PACKET_LENGTH];
+    uint8_t *out = packet;
+
+    uint8_t len = message.len > 8 ? 8 : message.len;
+    *out++ = (message.extended ? PACKET_EXTENDED : 0) | (message.rtr ? PACKET_RTR : 0) | len;
+
+    for (int i = 0; i < (message.extended ? 4 : 2); i++)
+        *out++ = message.id >> (i * 8);
+
+    // deltas between frames on a busy bus fit in one or two bytes
+    uint32_t delta = frame.timestamp - lastTimestamp;
+    lastTimestamp = frame.timestamp;
+    while (delta >= 0x80) {
+        *out++ = (delta & 0x7f) | 0x80;
+        delta >>= 7;
+    }
+    *out++ = delta;
+
+    if (!message.rtr) {
+        memcpy(out, message.data, len);
+        out += len;
+    }
+
+    return finishPacket(packet, out - packet, buf);
+}
+
+// appends the crc, then writes the stuffed packet and its delimiter into buf.
+// packet needs room for the 2 crc bytes
+size_t SLCAN::finishPacket(uint8_t *packet, size_t n, char *buf) {
+    uint16_t crc = crc16(packet, n);
+    packet[n++] = crc;
+    packet[n++] = crc >> 8;
+
+    size_t length = cobsEncode(packet, n, (uint8_t *)buf);
+    buf[length++] = 0;
+    return length;
+}
+
+void SLCAN::sendReply(const char *reply, size_t n, bool binary) {
+    if (!binary) {
+        serial.write((const uint8_t *)reply, n);
         return;
+    }
 
-    CANMessage message;
-    message.id = (hex2int(buf[0]) << 8) | (hex2int(buf[1]) << 4) | hex2int(buf[2]);
-    message.len = hex2int(buf[3]);
-    buf += 4;
-    n -= 4;
+    uint8_t packet[1 + MAX_REPLY_LENGTH + 2];
+    packet[0] = PACKET_REPLY;
+    memcpy(packet + 1, reply, n);
 
-    if (message.len > 8)
+    char buf[sizeof(packet) + 2];
+    serial.write((const uint8_t *)buf, finishPacket(packet, n + 1, buf));
+}
+
+void SLCAN::readInput(size_t budget) {
+    for (size_t i = 0; i < budget && serial.available() > 0; i++)
+        parseInput(serial.read());
+}
+
+void SLCAN::process() {
+    if (transmitQueue.empty())
         return;
 
-    for (unsigned i = 0; i < message.len && n >= 2; i++, buf += 2, n -= 2) {
-        message.data[i] = (hex2int(buf[0]) << 4) | hex2int(buf[1]);
+    // nothing will go out until the controller recovers, tell the host now
+    if (can.errorStatus() == CAN_BUS_OFF) {
+        dropQueuedMessages();
+        return;
     }
 
-    can.transmit(message);
+    CANMessage message;
+    while (transmitQueue.peek(message)) {
+        // controller queue is full, try again next loop
+        if (!can.transmit(message))
+            break;
+        transmitQueue.pop(message);
+        transmitted++;
+    }
+}
+
+SLCAN::TransmitStatistics SLCAN::getTransmitStatistics() const {
+    TransmitStatistics statistics;
+    statistics.rejected = transmitQueue.getOverflows();
+    statistics.queued = transmitted + dropped + transmitQueue.size();
+    statistics.sent = transmitted;
+    statistics.dropped = dropped;
+    statistics.highWaterMark = transmitQueue.getHighWaterMark();
+    return statistics;
 }
 
-void SLCAN::printReceivedMessage(const CANMessage &message) {
-    Serial.printf("t%03x%d", message.id, message.len);
-    for(auto i = 0; i < message.len; i++) {
-        Serial.printf("%02x", message.data[i]);
+// every frame was already acknowledged, so each gets a bell
+void SLCAN::dropQueuedMessages() {
+    CANMessage message;
+    while (transmitQueue.pop(message)) {
+        dropped++;
+        sendReply(&BELL, 1, binary);
     }
-    Serial.write(SLCAN::NEW_LINE);
 }
 
 void SLCAN::parseInput(char c) {
-    if (inputPos < sizeof(inputBuffer)) {
-        inputBuffer[inputPos] = c;
-        inputPos++;
+    if (c != NEW_LINE) {
+        if (inputPos < sizeof(inputBuffer)) {
+            inputBuffer[inputPos] = c;
+            inputPos++;
+        } else {
+            inputOverflow = true;
+        }
+        return;
+    }
+
+    // B0/B1 take effect after their own reply
+    bool replyBinary = binary;
+    char reply[MAX_REPLY_LENGTH];
+    size_t replyLength = 0;
+
+    if (inputOverflow || (inputPos > 0 && !executeCommand(inputBuffer, inputPos, reply, replyLength))) {
+        reply[0] = BELL;
+        replyLength = 1;
+    } else {
+        // an empty line is how hosts flush the adapter, it still gets answered
+        reply[replyLength++] = NEW_LINE;
     }
 
-    if (c == NEW_LINE) {
-        switch (inputBuffer[0]) {
-            case 'O':
-                openCAN();
-                break;
-            case 'C':
-                closeCAN();
-                break;
-            case 't':
-                transmitMessage(&inputBuffer[1], inputPos - 2);
-                break;
+    sendReply(reply, replyLength, replyBinary);
+
+    inputPos = 0;
+    inputOverflow = false;
+}
+
+// runs a complete command (without the trailing '\r'). any reply goes in front
+// of the '\r' parseInput adds, failures are answered with a bell instead
+bool SLCAN::executeCommand(const char *buf, unsigned n, char *reply, size_t& replyLength) {
+    switch (buf[0]) {
+        case 'O':
+            if (n != 1 || open)
+                return false;
+            openCAN();
+            break;
+        case 'C':
+            if (n != 1 || !open)
+                return false;
+            closeCAN();
+            break;
+        case 'S':
+            if (!setBitrate(buf + 1, n - 1))
+                return false;
+            break;
+        case 't':
+        case 'T':
+        case 'r':
+        case 'R': {
+            bool extended = buf[0] == 'T' || buf[0] == 'R';
+            bool rtr = buf[0] == 'r' || buf[0] == 'R';
+            if (!transmitMessage(buf + 1, n - 1, extended, rtr))
+                return false;
+            // transmit acknowledgement differs by frame format
+            reply[replyLength++] = extended ? 'Z' : 'z';
+            break;
         }
-        inputPos = 0;
+        case 'F':
+            if (n != 1 || !open)
+                return false;
+            replyLength = formatStatus(reply) - reply;
+            break;
+        case 'V':
+            replyLength = strlen(VERSION);
+            memcpy(reply, VERSION, replyLength);
+            break;
+        case 'N':
+            replyLength = strlen(SERIAL_NUMBER);
+            memcpy(reply, SERIAL_NUMBER, replyLength);
+            break;
+        case 'Z':
+            if (n != 2 || (buf[1] != '0' && buf[1] != '1'))
+                return false;
+            setTimestamps(buf[1] == '1');
+            break;
+        case 'B':
+            if (n != 2 || (buf[1] != '0' && buf[1] != '1'))
+                return false;
+            binary = buf[1] == '1';
+            lastTimestamp = micros();
+            break;
+        case 'M':
+            if (!setAcceptanceFilter(buf + 1, n - 1, acceptanceCode))
+                return false;
+            break;
+        case 'm':
+            if (!setAcceptanceFilter(buf + 1, n - 1, acceptanceMask))
+                return false;
+            break;
+        default:
+            // s (raw BTR registers) and L (listen only) have no equivalent in
+            // the CANChannel api, so they are refused like unknown commands
+            return false;
+    }
+
+    return true;
+}
+
+bool SLCAN::transmitMessage(const char *buf, unsigned n, bool extended, bool rtr) {
+    if (!open)
+        return false;
+
+    unsigned idDigits = extended ? 8 : 3;
+    if (n < idDigits + 1)
+        return false;
+
+    CANMessage message;
+    uint32_t id, len;
+    if (!Hex::decode(buf, idDigits, id) || !Hex::decode(buf + idDigits, 1, len))
+        return false;
+    if (id > (extended ? 0x1fffffffu : 0x7ffu) || len > 8)
+        return false;
+
+    message.id = id;
+    message.extended = extended;
+    message.rtr = rtr;
+    message.len = len;
+    buf += idDigits + 1;
+    n -= idDigits + 1;
+
+    // remote frames carry a length but no data
+    if (n != (rtr ? 0 : message.len * 2))
+        return false;
+
+    if (!Hex::decodeBytes(buf, message.data, n / 2))
+        return false;
+
+    if (!transmitQueue.push(message))
+        return false;
+
+    // most of the time the controller has room and the frame goes straight out
+    process();
+    return true;
+}
+
+bool SLCAN::setBitrate(const char *buf, unsigned n) {
+    // only changeable while the channel is closed
+    if (can.isEnabled() || n != 1)
+        return false;
+
+    unsigned index = buf[0] - '0';
+    if (index >= sizeof(standardBitrates) / sizeof(standardBitrates[0]))
+        return false;
+
+    bitrate = standardBitrates[index];
+    return true;
+}
+
+bool SLCAN::setAcceptanceFilter(const char *buf, unsigned n, uint32_t& value) {
+    if (can.isEnabled() || n != 8)
+        return false;
+
+    return Hex::decode(buf, 8, value);
+}
+
+char *SLCAN::formatStatus(char *out) {
+    uint8_t status = 0;
+    switch (can.errorStatus()) {
+        case CAN_ERROR_PASSIVE:
+            status |= STATUS_ERROR_PASSIVE;
+            break;
+        case CAN_BUS_OFF:
+            status |= STATUS_BUS_ERROR;
+            break;
+        default:
+            break;
     }
+    *out++ = 'F';
+    return Hex::encode(out, status, 2);
 }
 
-unsigned SLCAN::hex2int(char c) {
-    if (c >= '0' && c <= '9')
-        return c - '0';
-    else if (c >= 'a' && c <= 'f')
-        return c - 'a' + 10;
-    else if (c >= 'A' && c <= 'F')
-        return c - 'A' + 10;
+// the SJA1000 single filter layout puts standard ids in the top 11 bits and
+// extended ids in the top 29, so the one code/mask pair becomes one filter of each
+void SLCAN::applyAcceptanceFilter() {
+    if (acceptanceMask == ACCEPT_ALL)
+        return;
 
-    return 0;
+    uint32_t mask = ~acceptanceMask;
+    can.clearFilters();
+    can.addFilter(acceptanceCode >> 21, mask >> 21, CAN_FILTER_STANDARD);
+    can.addFilter(acceptanceCode >> 3, mask >> 3, CAN_FILTER_EXTENDED);
 }
 
 void SLCAN::openCAN() {
+    if (open)
+        return;
+
+    open = true;
     if (can.isEnabled())
         return;
 
-    can.begin(33333);
+    applyAcceptanceFilter();
+    can.begin(bitrate);
+    ownsChannel = true;
 }
 
 void SLCAN::closeCAN() {
-    if (!can.isEnabled())
+    if (!open)
+        return;
+
+    dropQueuedMessages();
+    open = false;
+    if (!ownsChannel)
         return;
 
     can.end();
+    ownsChannel = false;
 }
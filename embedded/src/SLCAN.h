@@ -1,21 +1,121 @@
 #pragma once
 
 #include "application.h"
+#include "CANFrame.h"
+#include "Hex.h"
+#include "RingBuffer.h"
 
+// Lawicel serial line CAN protocol, so the Carloop can be used as a standard
+// adapter by slcand, python-can, SavvyCAN and friends.
+// Every command is answered with '\r' on success or '\a' on failure.
+//
+// B1 switches the output to a compact binary stream for logging busy buses,
+// B0 switches back. Commands stay text either way. Each packet is COBS encoded
+// and ends with a 0 byte:
+//   header: 0x80 reply, 0x40 extended, 0x20 remote, low nibble data length
+//   frame: id (2 or 4 bytes), varint microseconds since the previous frame, data
+//   reply: the text reply to a command
+//   crc-16/ccitt-false of all of the above, little endian
+// A command's reply is sent in the mode it was received in.
+// embedded/tools/slcan_binary.py turns the stream back into candump logs.
+//
+// The channel can be shared with the rest of the firmware: if it is already
+// running when the host opens it, SLCAN only starts streaming and leaves the
+// bitrate alone, so S and M/m are refused until it is closed elsewhere.
 class SLCAN {
 public:
-    SLCAN(CANChannel& can): can(can) {}
+    struct TransmitStatistics {
+        uint32_t queued = 0;
+        uint32_t sent = 0;
+        // refused with a bell because the queue was full
+        uint32_t rejected = 0;
+        // queued but thrown away, the bus went off or the channel closed
+        uint32_t dropped = 0;
+        size_t highWaterMark = 0;
+    };
 
-    void transmitMessage(const char *buf, unsigned n);
-    void printReceivedMessage(const CANMessage &message);
+    SLCAN(CANChannel& can, USBSerial& serial): can(can), serial(serial) {}
+
+    // feeds at most `budget` waiting bytes to parseInput, so a host flooding
+    // commands can't hold up the rest of the loop
+    void readInput(size_t budget);
+    // hands queued frames to the controller as its mailboxes free up, call every loop
+    void process();
+    // between the host's O and C
+    bool isOpen() const { return open; }
+    // received frames not sent because the host wasn't reading fast enough
+    uint32_t getOverruns() const { return overruns; }
+    TransmitStatistics getTransmitStatistics() const;
+
+    void printReceivedMessage(const CANFrame &frame);
+    // renders every frame into one buffer so the whole batch costs one write.
+    // never blocks, frames that don't fit in the serial buffer are counted as overruns
+    void printReceivedMessages(const CANFrame *frames, size_t count);
     void parseInput(char c);
     void openCAN();
     void closeCAN();
+    // append the lawicel 4 digit millisecond timestamp to received frames
+    void setTimestamps(bool enabled) { timestamps = enabled; }
 private:
-    unsigned hex2int(char c);
+    size_t formatReceivedMessage(const CANFrame &frame, char *buf);
+    size_t formatBinaryMessage(const CANFrame &frame, char *buf);
+    size_t finishPacket(uint8_t *packet, size_t n, char *buf);
+    void sendReply(const char *reply, size_t n, bool binary);
+    bool executeCommand(const char *buf, unsigned n, char *reply, size_t& replyLength);
+    bool transmitMessage(const char *buf, unsigned n, bool extended, bool rtr);
+    bool setBitrate(const char *buf, unsigned n);
+    bool setAcceptanceFilter(const char *buf, unsigned n, uint32_t& value);
+    char *formatStatus(char *out);
+    void applyAcceptanceFilter();
+    void dropQueuedMessages();
 
     CANChannel& can;
+    USBSerial& serial;
+    bool open = false;
+    // whether O started the channel, and C should stop it
+    bool ownsChannel = false;
+    uint32_t overruns = 0;
     const char NEW_LINE = '\r';
+    const char BELL = '\a';
+    // longest command is an extended frame: T + 8 id + 1 length + 16 data
     char inputBuffer[40];
     unsigned inputPos = 0;
+    bool inputOverflow = false;
+    bool timestamps = false;
+    bool binary = false;
+    // binary frames carry the time since this
+    uint32_t lastTimestamp = 0;
+    unsigned long bitrate = DEFAULT_BITRATE;
+
+    // SJA1000 style single filter, mask bits set are don't care
+    uint32_t acceptanceCode = 0;
+    uint32_t acceptanceMask = ACCEPT_ALL;
+
+    // GMLAN single wire, the bus the Carloop is normally plugged into
+    static constexpr unsigned long DEFAULT_BITRATE = 33333;
+    // T + 8 id + 1 length + 16 data + 4 timestamp + '\r'
+    // binary is shorter: header + 4 id + 5 varint + 8 data + 2 crc, COBS and delimiter
+    static constexpr size_t MAX_MESSAGE_LENGTH = 31;
+    static constexpr size_t MAX_PACKET_LENGTH = 20;
+    static constexpr size_t MAX_REPLY_LENGTH = 8;
+    static constexpr size_t MAX_BATCH_LENGTH = 256;
+    // on top of the controller's 32, enough for a scripted burst
+    static constexpr size_t TX_QUEUE_SIZE = 32;
+    static constexpr uint32_t ACCEPT_ALL = 0xffffffff;
+    static constexpr const char *VERSION = "V1010";
+    static constexpr const char *SERIAL_NUMBER = "NB001";
+
+    // status flags reported by F
+    static constexpr uint8_t STATUS_ERROR_PASSIVE = 0x20;
+    static constexpr uint8_t STATUS_BUS_ERROR = 0x80;
+
+    // binary packet header
+    static constexpr uint8_t PACKET_REPLY = 0x80;
+    static constexpr uint8_t PACKET_EXTENDED = 0x40;
+    static constexpr uint8_t PACKET_RTR = 0x20;
+
+    // frames are acknowledged once queued, the controller only holds a few
+    RingBuffer<CANMessage, TX_QUEUE_SIZE> transmitQueue;
+    uint32_t transmitted = 0;
+    uint32_t dropped = 0;
 };
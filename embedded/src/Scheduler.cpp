@@ -0,0 +1,117 @@
+#include "Scheduler.h"
+
+void Scheduler::begin() {
+    if (wakeSemaphore)
+        return;
+
+    // a single count, any number of wakes while busy end one idle()
+    os_semaphore_create(&wakeSemaphore, 1, 0);
+    idleStatisticsStart = micros();
+}
+
+Scheduler::TaskId Scheduler::every(system_tick_t period, Task task) {
+    return add(period, period, true, task);
+}
+
+Scheduler::TaskId Scheduler::after(system_tick_t delay, Task task) {
+    return add(delay, 0, false, task);
+}
+
+Scheduler::TaskId Scheduler::add(system_tick_t delay, system_tick_t period, bool repeat, Task task) {
+    for (TaskId id = 0; id < MAX_TASKS; id++) {
+        Entry& entry = tasks[id];
+        if (entry.task)
+            continue;
+
+        entry.task = task;
+        entry.period = period;
+        entry.due = millis() + delay;
+        entry.repeat = repeat;
+        return id;
+    }
+
+    Serial.println("Scheduler is full");
+    return NO_TASK;
+}
+
+void Scheduler::cancel(TaskId id) {
+    if (id < MAX_TASKS)
+        tasks[id] = Entry();
+}
+
+void Scheduler::run() {
+    for (TaskId id = 0; id < MAX_TASKS; id++) {
+        Entry& entry = tasks[id];
+        if (!entry.task)
+            continue;
+
+        // the clock moves while earlier tasks run
+        system_tick_t now = millis();
+        if ((int32_t)(now - entry.due) < 0)
+            continue;
+
+        Task task = entry.task;
+        if (!entry.repeat) {
+            tasks[id] = Entry();
+        } else {
+            entry.due += entry.period;
+            // a task that fell a whole period behind starts over rather than
+            // running back to back to catch up
+            if ((int32_t)(now - entry.due) >= 0)
+                entry.due = now + entry.period;
+        }
+        task();
+    }
+}
+
+system_tick_t Scheduler::timeUntilNext() const {
+    system_tick_t now = millis();
+    system_tick_t next = 0;
+    bool found = false;
+
+    for (TaskId id = 0; id < MAX_TASKS; id++) {
+        const Entry& entry = tasks[id];
+        if (!entry.task || (entry.repeat && entry.period == 0))
+            continue;
+
+        int32_t remaining = (int32_t)(entry.due - now);
+        if (remaining <= 0)
+            return 0;
+        if (!found || (system_tick_t)remaining < next)
+            next = remaining;
+        found = true;
+    }
+    return found ? next : NO_DEADLINE;
+}
+
+void Scheduler::idle(system_tick_t maxWait) {
+    system_tick_t wait = timeUntilNext();
+    if (maxWait < wait)
+        wait = maxWait;
+    if (wait == 0 || !wakeSemaphore)
+        return;
+
+    uint32_t start = micros();
+    if (os_semaphore_take(wakeSemaphore, wait, false) == 0)
+        idleStatistics.wakeups++;
+    else
+        idleStatistics.timeouts++;
+    idleStatistics.blocked += micros() - start;
+}
+
+void Scheduler::wake() {
+    // fails when a wake is already pending, which is just as good
+    if (wakeSemaphore)
+        os_semaphore_give(wakeSemaphore, false);
+}
+
+Scheduler::IdleStatistics Scheduler::getIdleStatistics() const {
+    IdleStatistics statistics = idleStatistics;
+    statistics.busy = (micros() - idleStatisticsStart) - statistics.blocked;
+    return statistics;
+}
+
+void Scheduler::resetIdleStatistics() {
+    idleStatistics = IdleStatistics();
+    idleStatisticsStart = micros();
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "application.h"
+
+// Cooperative scheduler for the main loop. Tasks are plain functions run from
+// run() once they're due, so none of them may block: anything that used to
+// delay() waits for its next turn instead.
+// Times are millis(), compared by difference so the 49 day wrap is harmless.
+//
+// Between passes idle() blocks the application thread until the next timed
+// task is due or something calls wake(), so a parked car with nothing to do
+// leaves the core to the RTOS instead of spinning. System.sleep's stop mode
+// would save more, but it halts the clocks the radio's HCI UART and USB run
+// on and the phone's supervision timeout drops the connection.
+class Scheduler {
+public:
+    typedef void (*Task)();
+    typedef size_t TaskId;
+
+    // microseconds, since the last resetIdleStatistics(). blocked is time the
+    // application thread spent waiting in idle(), not time the core slept:
+    // the RTOS runs the other threads or its idle task meanwhile
+    struct IdleStatistics {
+        uint32_t busy = 0;
+        uint32_t blocked = 0;
+        // idle() calls cut short by wake(), the rest ran into a deadline
+        uint32_t wakeups = 0;
+        uint32_t timeouts = 0;
+    };
+
+    static constexpr size_t MAX_TASKS = 8;
+    static constexpr TaskId NO_TASK = MAX_TASKS;
+    static constexpr system_tick_t NO_DEADLINE = 0xffffffff;
+
+    // runs task every period, starting one period from now.
+    // a period of 0 runs it on every pass
+    TaskId every(system_tick_t period, Task task);
+    // runs task once, delay from now
+    TaskId after(system_tick_t delay, Task task);
+    void cancel(TaskId id);
+
+    // creates the wake semaphore, call from setup() before anything can wake()
+    void begin();
+
+    // runs every due task once, in the order they were added
+    void run();
+    // milliseconds until the next timed task is due, 0 if one is due already.
+    // tasks run on every pass don't count, they run whenever the loop wakes.
+    // NO_DEADLINE if there are only those
+    system_tick_t timeUntilNext() const;
+    // blocks until the next timed task, a wake() or maxWait, whichever is first
+    void idle(system_tick_t maxWait);
+    // ends the current or next idle(), from any thread
+    void wake();
+
+    IdleStatistics getIdleStatistics() const;
+    void resetIdleStatistics();
+
+private:
+    struct Entry {
+        Task task = nullptr;
+        system_tick_t period = 0;
+        system_tick_t due = 0;
+        bool repeat = false;
+    };
+
+    TaskId add(system_tick_t delay, system_tick_t period, bool repeat, Task task);
+
+    Entry tasks[MAX_TASKS];
+    os_semaphore_t wakeSemaphore = nullptr;
+
+    IdleStatistics idleStatistics;
+    uint32_t idleStatisticsStart = 0;
+};
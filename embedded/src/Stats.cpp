@@ -0,0 +1,55 @@
+#include "Stats.h"
+
+void Stats::frameReceived() {
+    framesReceived++;
+}
+
+void Stats::frameHandled(uint32_t capturedMicros) {
+    uint32_t latency = micros() - capturedMicros;
+
+    framesHandled++;
+    totalLatency += latency;
+    if (latency > maxLatency)
+        maxLatency = latency;
+}
+
+void Stats::frameStreamed() {
+    framesStreamed++;
+}
+
+void Stats::frameDropped() {
+    framesDropped++;
+}
+
+bool Stats::reportIfDue() {
+    system_tick_t now = millis();
+    system_tick_t elapsed = now - intervalStart;
+    if (elapsed < REPORT_INTERVAL)
+        return false;
+
+    // a growing heap delta between reports means something is allocating per frame
+    uint32_t freeMemory = System.freeMemory();
+    int32_t freeMemoryDelta = lastFreeMemory ? (int32_t)(freeMemory - lastFreeMemory) : 0;
+
+    Serial.printlnf(
+        "Stats: %lu frames (%lu/s), %lu handled, latency avg %lu us max %lu us, free memory %lu (%ld)",
+        framesReceived,
+        framesReceived * 1000 / elapsed,
+        framesHandled,
+        framesHandled ? totalLatency / framesHandled : 0,
+        maxLatency,
+        freeMemory,
+        freeMemoryDelta);
+    if (framesStreamed || framesDropped)
+        Serial.printlnf("Stats: %lu frames streamed (%lu/s), %lu dropped", framesStreamed, framesStreamed * 1000 / elapsed, framesDropped);
+
+    framesReceived = 0;
+    framesHandled = 0;
+    framesStreamed = 0;
+    framesDropped = 0;
+    totalLatency = 0;
+    maxLatency = 0;
+    intervalStart = now;
+    lastFreeMemory = freeMemory;
+    return true;
+}
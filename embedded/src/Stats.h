@@ -0,0 +1,34 @@
+#pragma once
+
+#include "application.h"
+
+// On-device measurements of the CAN -> BLE path, printed over serial.
+// The host benchmarks in bench/ measure changes against the simulated bus,
+// this is how they are checked on the car, against real bus traffic.
+class Stats {
+public:
+    // call for every frame taken off the receive queue
+    void frameReceived();
+    // call once a frame has been handed to its characteristic, with its capture time
+    void frameHandled(uint32_t capturedMicros);
+    // call for every frame packed into the BLE stream
+    void frameStreamed();
+    // call for every frame the BLE stream refused because its queue was backed up
+    void frameDropped();
+
+    // prints and resets the counters every REPORT_INTERVAL, returns whether it did
+    bool reportIfDue();
+
+private:
+    uint32_t framesReceived = 0;
+    uint32_t framesHandled = 0;
+    uint32_t framesStreamed = 0;
+    uint32_t framesDropped = 0;
+    uint32_t totalLatency = 0;
+    uint32_t maxLatency = 0;
+
+    system_tick_t intervalStart = 0;
+    uint32_t lastFreeMemory = 0;
+
+    static constexpr system_tick_t REPORT_INTERVAL = 10000;
+};
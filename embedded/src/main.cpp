@@ -6,16 +6,50 @@
 
 #include "application.h"
 #include "SLCAN.h"
+#include "CANDispatcher.h"
+#include "CANReceiver.h"
 #include "BatteryManager.h"
 #include "Bluetooth.h"
+#include "Stats.h"
+#include "Scheduler.h"
 
 SYSTEM_THREAD(ENABLED);
 SYSTEM_MODE(MANUAL);
 BLE_SETUP(DISABLED);
 
+// service and characteristic uuids, parsed at compile time
+constexpr BLE::UUID ledBlinkerServiceUUID("70DA7AB7-4FE2-4614-B092-2E8EC60290BB");
+constexpr BLE::UUID blinkCharacteristicUUID("6962CDC6-DCB1-465B-8AA4-23491CAF4840");
+constexpr BLE::UUID canServiceUUID("9A7E8B1D-EA49-40D6-B575-406AD07F8816");
+// the steering wheel and battery payloads grew under the same uuids, apps that
+// check the old 1 and 2 byte lengths exactly reject them, see README.md
+constexpr BLE::UUID steeringWheelCharacteristicUUID("BBBEF1D2-E1E6-4189-BE0B-C00D6D3CC6BB");
+constexpr BLE::UUID batteryCharacteristicUUID("63F13CE9-63B0-4ED3-8EBA-27441DDFC18E");
+constexpr BLE::UUID canStreamCharacteristicUUID("2CBF8759-DF12-4B1C-9D32-B9C1C8E87CDC");
+
+// GATT layout, has to match the characteristics each service adds
+constexpr BLE::GattEntry ledBlinkerServiceSchema[] = {
+    BLE::GattEntry::service(ledBlinkerServiceUUID),
+    BLE::GattEntry::characteristic(blinkCharacteristicUUID, BLE::Properties::Read | BLE::Properties::Write | BLE::Properties::Dynamic)
+};
+constexpr BLE::GattEntry canServiceSchema[] = {
+    BLE::GattEntry::service(canServiceUUID),
+    BLE::GattEntry::characteristic(steeringWheelCharacteristicUUID, BLE::Properties::Read | BLE::Properties::Indicate),
+    BLE::GattEntry::characteristic(batteryCharacteristicUUID, BLE::Properties::Read | BLE::Properties::Indicate),
+    BLE::GattEntry::characteristic(canStreamCharacteristicUUID, BLE::Properties::Read | BLE::Properties::Notify)
+};
+static_assert(
+    BLE::standardServiceHandleCount + BLE::handleCount(ledBlinkerServiceSchema) + BLE::handleCount(canServiceSchema) < BLE::Manager::MAX_HANDLES,
+    "GATT layout needs more handles than BLE::Manager has");
+
+// what the characteristics read as before their first update
+const uint8_t initialBlinkValue[] = { 0 }; // off
+const uint8_t initialSteeringWheelValue[] = { 0, 0, 0, 0, 0 }; // no button
+const uint8_t initialBatteryValue[] = { 0, 0, 0, 0, 0, 0 };
+
 class LEDBlinkerService: public BLE::Service {
 public:
-    class BlinkCharacteristic: public BLE::MutableCharacteristic {
+    class BlinkCharacteristic: public BLE::MutableCharacteristic<1> {
     public:
         enum class State: uint8_t {
             Off = 0,
@@ -23,13 +57,13 @@ public:
         };
 
         BlinkCharacteristic(): MutableCharacteristic(
-            BLE::UUID("6962CDC6-DCB1-465B-8AA4-23491CAF4840"),
-            { static_cast<uint8_t>(State::Off) }) {
+            blinkCharacteristicUUID,
+            initialBlinkValue) {
             pinMode(D7, OUTPUT);
         }
 
-        virtual BLE::Error setValue(const std::vector<uint8_t>& newValue) override {
-            auto ret = MutableCharacteristic::setValue(newValue);
+        virtual BLE::Error setValue(BLE::Bytes newValue) override {
+            auto ret = MutableCharacteristic<1>::setValue(newValue);
             updateLed(getState());
             return ret;
         }
@@ -43,7 +77,7 @@ public:
     };
 
     LEDBlinkerService()
-        : Service(BLE::UUID("70DA7AB7-4FE2-4614-B092-2E8EC60290BB")) {
+        : Service(ledBlinkerServiceSchema) {
         blinkCharacteristic = std::make_shared<BlinkCharacteristic>();
 
         addCharacteristic(blinkCharacteristic);
@@ -53,121 +87,510 @@ public:
 };
 
 class CANService: public BLE::Service {
-    class SteeringWheelCharacteristic: public BLE::IndicateCharacteristic {
+    // state byte followed by the little endian micros() the frame was received at,
+    // so the app can order presses and measure latency
+    class SteeringWheelCharacteristic: public BLE::IndicateCharacteristic<5> {
     public:
         SteeringWheelCharacteristic()
-            : IndicateCharacteristic(BLE::UUID("BBBEF1D2-E1E6-4189-BE0B-C00D6D3CC6BB"), { 0 }) {}
-
-        void newState(uint8_t state) {
-            setValue({ state });
+            : IndicateCharacteristic(
+                steeringWheelCharacteristicUUID,
+                initialSteeringWheelValue,
+                BLE::Properties::None,
+                BLE::UpdatePolicy::Ordered) {}
+
+        // the steering wheel frame repeats while a button is held, only the
+        // press and release edges (and optional repeats) are indicated
+        void newState(uint8_t state, uint32_t timestamp) {
+            system_tick_t now = millis();
+
+            if (state == getValue()[0]) {
+                if (!readyToRepeat(state, now))
+                    return;
+                repeating = true;
+            } else {
+                repeating = false;
+            }
+
+            timeLastSent = now;
+            if (manager)
+                manager->noteActivity();
+            const uint8_t value[] = {
+                state,
+                (uint8_t)timestamp,
+                (uint8_t)(timestamp >> 8),
+                (uint8_t)(timestamp >> 16),
+                (uint8_t)(timestamp >> 24)
+            };
+            setValue(value);
         }
+    private:
+        bool readyToRepeat(uint8_t state, system_tick_t now) {
+            if (REPEAT_DELAY == 0 || state == NO_BUTTON)
+                return false;
+            return (now - timeLastSent) >= (repeating ? REPEAT_INTERVAL : REPEAT_DELAY);
+        }
+
+        bool repeating = false;
+        system_tick_t timeLastSent = 0;
+
+        static constexpr uint8_t NO_BUTTON = 0x00;
+        // held buttons re-send after REPEAT_DELAY, then every REPEAT_INTERVAL.
+        // off, the app treats every indicate as a separate press
+        static constexpr system_tick_t REPEAT_DELAY = 0;
+        static constexpr system_tick_t REPEAT_INTERVAL = 250;
     };
 
-    class BatteryCharacteristic: public BLE::IndicateCharacteristic {
+    // filtered voltage, then the minimum and maximum of the last window,
+    // each in little endian hundredths of a volt
+    class BatteryCharacteristic: public BLE::IndicateCharacteristic<6> {
     public:
         BatteryCharacteristic()
-            : IndicateCharacteristic(BLE::UUID("63F13CE9-63B0-4ED3-8EBA-27441DDFC18E"), { 0, 0 }) {}
+            : IndicateCharacteristic(batteryCharacteristicUUID, initialBatteryValue) {}
 
-        void newState(float state) {
-            if (!readyToSend())
+        void newState(const BatteryManager::Reading& reading) {
+            // nobody to send to, the first reading after subscribing goes out right away
+            if (!isSubscribed()) {
+                timeLastUpdated = 0;
+                return;
+            }
+            if (!readyToSend(reading.voltage))
                 return;
 
             timeLastUpdated = millis();
+            lastVoltage = reading.voltage;
 
             // two decimals of precision
-            uint16_t value = (uint16_t)(state * 100);
-            // split up uint16_t into two
-            setValue({ (uint8_t)(value & 0xff), (uint8_t)(value >> 8) });
-            Serial.printlnf("Sent battery value notification: %.2f", state);
+            uint16_t voltage = (uint16_t)(reading.voltage * 100);
+            uint16_t minimum = (uint16_t)(reading.minimum * 100);
+            uint16_t maximum = (uint16_t)(reading.maximum * 100);
+            const uint8_t value[] = {
+                (uint8_t)voltage, (uint8_t)(voltage >> 8),
+                (uint8_t)minimum, (uint8_t)(minimum >> 8),
+                (uint8_t)maximum, (uint8_t)(maximum >> 8)
+            };
+            setValue(value);
+            Serial.printlnf("Sent battery value notification: %.2f", reading.voltage);
         }
     private:
-        bool readyToSend() {
-            return (millis() - timeLastUpdated) > SEND_THROTTLE_DELAY;
+        // changes go out promptly, a steady battery only now and then
+        bool readyToSend(float voltage) {
+            system_tick_t elapsed = millis() - timeLastUpdated;
+            if (timeLastUpdated == 0 || elapsed >= SEND_INTERVAL)
+                return true;
+            float change = voltage > lastVoltage ? voltage - lastVoltage : lastVoltage - voltage;
+            return elapsed >= SEND_THROTTLE_DELAY && change >= SEND_THRESHOLD;
         }
 
         system_tick_t timeLastUpdated = 0;
-        static constexpr system_tick_t SEND_THROTTLE_DELAY = 500;
+        float lastVoltage = 0;
+        static constexpr system_tick_t SEND_THROTTLE_DELAY = 1000;
+        static constexpr system_tick_t SEND_INTERVAL = 30000;
+        static constexpr float SEND_THRESHOLD = 0.05f;
+    };
+
+    // every frame the acceptance filters let through, packed as many to a notification as fit.
+    // a notification starts with a sequence number (gaps mean dropped notifications),
+    // then for each frame:
+    //   flags: 0x80 extended, 0x40 remote, low nibble data length
+    //   id: 2 or 4 bytes, little endian
+    //   varint microseconds since the previous streamed frame
+    //   data
+    class CANStreamCharacteristic: public BLE::NotifyCharacteristic<BLE::Manager::MAX_UPDATE_LENGTH> {
+    public:
+        CANStreamCharacteristic()
+            : NotifyCharacteristic(
+                canStreamCharacteristicUUID,
+                BLE::Bytes(),
+                BLE::Properties::None,
+                BLE::UpdatePolicy::Ordered) {}
+
+        // returns false if the frame had to be dropped because the update queue is backed up
+        bool addFrame(const CANFrame& frame) {
+            uint8_t encoded[MAX_FRAME_LENGTH];
+            size_t length = encode(frame, encoded);
+
+            if (packetLength + length > packetCapacity())
+                flush();
+            if (packetLength + length + (packetLength == 0) > packetCapacity())
+                return false;
+
+            if (packetLength == 0) {
+                packet[packetLength++] = sequence;
+                packetStarted = millis();
+            }
+            memcpy(packet + packetLength, encoded, length);
+            packetLength += length;
+            lastTimestamp = frame.timestamp;
+            return true;
+        }
+
+        // a quiet bus shouldn't leave frames waiting for a full notification
+        void flushIfDue() {
+            if (packetLength > 0 && millis() - packetStarted >= FLUSH_INTERVAL)
+                flush();
+        }
+
+        // frames waiting for flushIfDue()
+        bool hasPendingFrames() const { return packetLength > 0; }
+
+    private:
+        size_t encode(const CANFrame& frame, uint8_t* out) const {
+            const CANMessage& message = frame.message;
+            uint8_t* start = out;
+
+            uint8_t len = message.len > 8 ? 8 : message.len;
+            *out++ = (message.extended ? EXTENDED : 0) | (message.rtr ? REMOTE : 0) | len;
+
+            for (int i = 0; i < (message.extended ? 4 : 2); i++)
+                *out++ = message.id >> (i * 8);
+
+            uint32_t delta = frame.timestamp - lastTimestamp;
+            while (delta >= 0x80) {
+                *out++ = (delta & 0x7f) | 0x80;
+                delta >>= 7;
+            }
+            *out++ = delta;
+
+            if (!message.rtr) {
+                memcpy(out, message.data, len);
+                out += len;
+            }
+            return out - start;
+        }
+
+        void flush() {
+            if (packetLength == 0 || !manager)
+                return;
+            // leave room in the queue for button presses
+            if (manager->availableUpdateSlots() <= RESERVED_UPDATE_SLOTS)
+                return;
+
+            manager->noteActivity();
+            setValue(BLE::Bytes(packet, packetLength));
+            sequence++;
+            packetLength = 0;
+        }
+
+        size_t packetCapacity() const {
+            return manager ? BLE::Manager::MAX_UPDATE_LENGTH : 0;
+        }
+
+        uint8_t packet[BLE::Manager::MAX_UPDATE_LENGTH];
+        size_t packetLength = 0;
+        uint8_t sequence = 0;
+        system_tick_t packetStarted = 0;
+        uint32_t lastTimestamp = 0;
+
+        static constexpr uint8_t EXTENDED = 0x80;
+        static constexpr uint8_t REMOTE = 0x40;
+        // flags + 4 id + 5 varint + 8 data
+        static constexpr size_t MAX_FRAME_LENGTH = 18;
+        static constexpr size_t RESERVED_UPDATE_SLOTS = 4;
+        static constexpr system_tick_t FLUSH_INTERVAL = 20;
     };
 
 public:
-    CANService() : Service(BLE::UUID("9A7E8B1D-EA49-40D6-B575-406AD07F8816")) {
+    CANService() : Service(canServiceSchema) {
         steeringWheelCharacteristic = std::make_shared<SteeringWheelCharacteristic>();
         batteryCharacteristic = std::make_shared<BatteryCharacteristic>();
+        canStreamCharacteristic = std::make_shared<CANStreamCharacteristic>();
 
         addCharacteristic(steeringWheelCharacteristic);
         addCharacteristic(batteryCharacteristic);
+        addCharacteristic(canStreamCharacteristic);
     }
 
     std::shared_ptr<SteeringWheelCharacteristic> steeringWheelCharacteristic;
     std::shared_ptr<BatteryCharacteristic> batteryCharacteristic;
+    std::shared_ptr<CANStreamCharacteristic> canStreamCharacteristic;
 };
 
+// GMLAN frame ids
+const uint32_t steeringWheelId = 0x290;
+// system power mode, broadcast while the car is awake
+const uint32_t powerModeId = 0x1F1;
+
+// frames handled per loop pass, bounds how long BLE waits while the bus is busy
+const size_t framesPerPass = 16;
+// serial bytes read per loop pass, a few commands
+const size_t slcanInputBudget = 64;
+// power mode frames stop while the car sleeps, their return after this long means it is waking up
+const system_tick_t busQuietTime = 5000;
+// task periods, nothing in the loop waits on these
+const system_tick_t blinkInterval = 750;
+const system_tick_t sleepCheckInterval = 1000;
+const system_tick_t statsInterval = 1000;
+// longest loop() sleeps with nothing due, wakes come from CAN and BLE events well before
+const system_tick_t maxIdleTime = 1000;
+
 CANChannel can(CAN_D1_D2);
+CANReceiver receiver(can);
+CANDispatcher dispatcher;
+// lawicel bridge on the second usb serial port, debug output stays on Serial
+SLCAN slcan(can, USBSerial1);
 std::shared_ptr<BatteryManager> batteryManager(std::make_shared<BatteryManager>());
 std::unique_ptr<BLE::Manager> bluetooth;
 std::shared_ptr<CANService> canService;
 std::shared_ptr<LEDBlinkerService> ledBlinkerService;
+Stats stats;
+Scheduler scheduler;
+
+void processCAN();
+void processBluetooth();
+void blinkWhileDisconnected();
+void sampleBattery();
+void sleepIfCarIsOff();
+void reportStats();
+system_tick_t idleBudget();
+void haltWithError(const char* error);
 
 void setup() {
     Serial.begin();
+    USBSerial1.begin();
 
     batteryManager->setup();
 
+    // lit while bluetooth comes up
     pinMode(D7, OUTPUT);
-
-    digitalWrite(D7, HIGH);
-    delay(1000);
-    digitalWrite(D7, LOW);
-    delay(1000);
     digitalWrite(D7, HIGH);
 
+    scheduler.begin();
+
     Serial.println("About to init bluetooth");
-    bluetooth = BLE::bluetooth();
+    bluetooth = BLE::bluetooth(canServiceUUID);
+    if (!bluetooth)
+        haltWithError("Could not add the standard bluetooth services!");
     Serial.println("Initialized bluetooth!");
+    bluetooth->onEvent([]() { scheduler.wake(); });
 
     digitalWrite(D7, LOW);
 
     ledBlinkerService = std::make_shared<LEDBlinkerService>();
-    bluetooth->addService(ledBlinkerService);
+    if (!bluetooth->addService(ledBlinkerService))
+        haltWithError("Could not add the LED blinker service!");
 
     canService = std::make_shared<CANService>();
-    bluetooth->addService(canService);
+    if (!bluetooth->addService(canService))
+        haltWithError("Could not add the CAN service!");
+
+    dispatcher.on(steeringWheelId, [](const CANFrame& frame) {
+        // steering wheel button is fourth byte
+        canService->steeringWheelCharacteristic->newState(frame.message.data[3], frame.timestamp);
+    });
+    // the filters only pass handled ids, this is how the car waking up gets through them
+    dispatcher.on(powerModeId, [](const CANFrame& frame) {
+        static system_tick_t lastFrameTime = 0;
+        // the driver is probably about to look for us, advertise fast again
+        if (frame.milliseconds - lastFrameTime > busQuietTime)
+            bluetooth->wakeAdvertising();
+        lastFrameTime = frame.milliseconds;
+    });
 
     Serial.println("About to begin advertising");
     bluetooth->startAdvertising();
     Serial.println("Began advertising!");
 
+    dispatcher.applyFilters(can);
     can.begin(33333);
+    receiver.onReceive([]() { scheduler.wake(); });
+    receiver.begin();
+
+    scheduler.every(0, processCAN);
+    scheduler.every(0, processBluetooth);
+    scheduler.every(blinkInterval, blinkWhileDisconnected);
+    scheduler.every(BatteryManager::SAMPLE_INTERVAL, sampleBattery);
+    scheduler.every(sleepCheckInterval, sleepIfCarIsOff);
+    scheduler.every(statsInterval, reportStats);
 }
 
-void loop() {
+bool isStreaming() {
+    return bluetooth->isConnected() && canService->canStreamCharacteristic->isSubscribed();
+}
 
-    if (!bluetooth->isConnected()) {
+// the slcan host wants to see the whole bus, not just what the dispatcher needs.
+// the stream gets what the filters let through, a phone can't keep up with more
+void updateFilters() {
+    static bool wholeBus = false;
+
+    bool wanted = slcan.isOpen();
+    if (wanted == wholeBus)
+        return;
+
+    wholeBus = wanted;
+    if (wholeBus)
+        can.clearFilters();
+    else
+        dispatcher.applyFilters(can);
+}
+
+// host commands in, this pass's frames out, while the host has the bridge open
+void pumpBridge(const CANFrame* frames, size_t count) {
+    slcan.readInput(slcanInputBudget);
+
+    if (slcan.isOpen())
+        slcan.printReceivedMessages(frames, count);
+    slcan.process();
+}
+
+//MARK: tasks
+
+// frames keep arriving in the background, handle everything queued since last time.
+// done while disconnected too so no stale presses are waiting when the phone connects
+void processCAN() {
+    CANFrame frames[framesPerPass];
+    size_t count = 0;
+    bool streaming = isStreaming();
+    while (count < framesPerPass && receiver.receive(frames[count])) {
+        stats.frameReceived();
+
+        if (dispatcher.dispatch(frames[count]))
+            stats.frameHandled(frames[count].timestamp);
+        if (streaming) {
+            if (canService->canStreamCharacteristic->addFrame(frames[count]))
+                stats.frameStreamed();
+            else
+                stats.frameDropped();
+        }
+        count++;
+    }
+
+    pumpBridge(frames, count);
+    updateFilters();
+}
+
+// sends queued updates while connected, steps the advertising schedule while not
+void processBluetooth() {
+    if (bluetooth->isConnected())
+        canService->canStreamCharacteristic->flushIfDue();
+    // with the filters on the bus looks quiet, so the receive thread may back off.
+    // not while the connection is fast: a press goes out within 30 ms then, where an
+    // idle connection, a parked car's, already adds 100 ms or more
+    bool fastConnection = bluetooth->isConnected() && bluetooth->getConnectionStatistics().active;
+    receiver.allowQuietPolling(!slcan.isOpen() && !fastConnection);
+
+    bluetooth->process();
+}
+
+// the led belongs to the blinker service while connected
+void blinkWhileDisconnected() {
+    static bool lit = false;
+
+    // keep quiet while a host is logging
+    bool blinking = !bluetooth->isConnected() && !slcan.isOpen();
+    if (!blinking) {
+        if (lit)
+            digitalWrite(D7, LOW);
+        lit = false;
+        return;
+    }
+
+    lit = !lit;
+    if (lit)
         Serial.println("Not connected");
-        digitalWrite(D7, HIGH);
-        delay(750);
-        digitalWrite(D7, LOW);
-        delay(750);
+    digitalWrite(D7, lit ? HIGH : LOW);
+}
 
-        // if we are not connected we are advertising, and
-        // we should not be advertising if the car is off
-        // give it 15 seconds to connect first though
-        if (millis() > 15000)
-            batteryManager->sleepIfLowBattery();
+// disconnected too, the sleep check needs a settled reading.
+// the phone doesn't get one before that either
+void sampleBattery() {
+    batteryManager->sample();
 
+    if (bluetooth->isConnected() && batteryManager->isSettled())
+        canService->batteryCharacteristic->newState(batteryManager->getReading());
+}
+
+// if we are not connected we are advertising, and
+// we should not be advertising if the car is off
+// give it 15 seconds to connect first though
+void sleepIfCarIsOff() {
+    if (bluetooth->isConnected() || slcan.isOpen())
+        return;
+
+    if (millis() > 15000)
+        batteryManager->sleepIfLowBattery();
+}
+
+void reportStats() {
+    // the duty cycle is reported for connected time only
+    if (!bluetooth->isConnected()) {
+        scheduler.resetIdleStatistics();
         return;
     }
+    if (!stats.reportIfDue())
+        return;
 
-    canService->batteryCharacteristic->newState(batteryManager->readBattery());
+    const BLE::Manager::QueueStatistics& queue = bluetooth->getQueueStatistics();
+    Serial.printlnf(
+        "BLE queue: %lu enqueued, %lu coalesced, %lu dropped, %lu sent, high water %d",
+        queue.enqueued, queue.coalesced, queue.dropped, queue.sent, queue.highWaterMark);
+    const BLE::Manager::ConnectionStatistics& connection = bluetooth->getConnectionStatistics();
+    Serial.printlnf(
+        "BLE connection: %s, %lu parameter requests (%lu refused), queue delay %lu us max %lu us",
+        connection.active ? "active" : "idle", connection.updatesRequested, connection.updatesRefused,
+        connection.lastQueueDelay, connection.maxQueueDelay);
+    Serial.printlnf(
+        "CAN queue: %lu overflows, high water %d of %d",
+        receiver.getOverflows(), receiver.getHighWaterMark(), CANReceiver::capacity());
+
+    if (slcan.isOpen()) {
+        SLCAN::TransmitStatistics transmit = slcan.getTransmitStatistics();
+        Serial.printlnf(
+            "SLCAN: %lu overruns, %lu queued, %lu sent, %lu rejected, %lu dropped, high water %d",
+            slcan.getOverruns(), transmit.queued, transmit.sent, transmit.rejected, transmit.dropped, transmit.highWaterMark);
+    }
 
-    //TODO: make a lil framework out of this
-    CANMessage message;
-    while(can.receive(message)) {
-        // steering wheel id
-        if (message.id == 0x290) {
-            // steering wheel button is fourth byte
-            uint8_t value = message.data[3];
-            canService->steeringWheelCharacteristic->newState(value);
+    const BatteryManager::Reading& battery = batteryManager->getReading();
+    Serial.printlnf(
+        "Battery: %.2f V, %.2f to %.2f V, ripple %.2f V",
+        battery.voltage, battery.minimum, battery.maximum, battery.ripple);
+
+    // the application thread's duty cycle, and how often the can thread woke to poll
+    // over the same time. nothing stops the core's clock, blocked only means the
+    // application thread left it to the RTOS. each poll is a few microseconds of work,
+    // but together with the loop's passes they are what keeps the core out of idle
+    static uint32_t lastPolls = 0;
+    uint32_t polls = receiver.getPolls();
+    Scheduler::IdleStatistics idle = scheduler.getIdleStatistics();
+    uint32_t total = idle.busy + idle.blocked;
+    Serial.printlnf(
+        "Loop: busy %lu ms, blocked %lu ms (%lu%% busy), %lu wakeups, %lu timeouts, can thread %lu polls (%lu/s)",
+        idle.busy / 1000, idle.blocked / 1000, total ? (uint32_t)((uint64_t)idle.busy * 100 / total) : 0,
+        idle.wakeups, idle.timeouts, polls - lastPolls, total ? (uint32_t)((uint64_t)(polls - lastPolls) * 1000000 / total) : 0);
+    lastPolls = polls;
+    scheduler.resetIdleStatistics();
+}
+
+// how long loop() may sleep once the due tasks have run
+system_tick_t idleBudget() {
+    // a busy bus leaves more than one pass of frames behind, and the wake that
+    // announced them has been used up
+    if (receiver.pending() > 0)
+        return 0;
+    // serial input has no wake up, the host's commands are polled for
+    if (slcan.isOpen())
+        return 1;
+    // the ATT server frees up without telling us, and partial packets flush on a timer
+    if (bluetooth->hasPendingUpdates() || canService->canStreamCharacteristic->hasPendingFrames())
+        return 1;
+    return maxIdleTime;
+}
+
+void loop() {
+    scheduler.run();
+    scheduler.idle(idleBudget());
+}
+
+// a service that doesn't match its schema would advertise a broken GATT table,
+// so stop instead: the LED flickers and the error repeats on the USB serial port
+void haltWithError(const char* error) {
+    pinMode(D7, OUTPUT);
+    while (true) {
+        Serial.println(error);
+        for (int i = 0; i < 10; i++) {
+            digitalWrite(D7, HIGH);
+            delay(50);
+            digitalWrite(D7, LOW);
+            delay(50);
         }
     }
 }
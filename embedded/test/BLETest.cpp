@@ -0,0 +1,288 @@
+#include "Check.h"
+#include "Mock.h"
+#include "Bluetooth.h"
+
+// The GATT server side of BLE::Manager: writes, reads and updates through the
+// attribute server, none of which may touch the heap once services are added.
+
+using namespace BLE;
+
+namespace {
+    constexpr UUID testServiceUUID("5C0D2E1A-7B64-4E0B-9F1D-3A2B1C0D9E8F");
+    constexpr UUID settingCharacteristicUUID("5C0D2E1B-7B64-4E0B-9F1D-3A2B1C0D9E8F");
+    constexpr UUID eventCharacteristicUUID("5C0D2E1C-7B64-4E0B-9F1D-3A2B1C0D9E8F");
+    constexpr GattEntry testServiceSchema[] = {
+        GattEntry::service(testServiceUUID),
+        GattEntry::characteristic(settingCharacteristicUUID, Properties::Read | Properties::Write | Properties::Dynamic),
+        GattEntry::characteristic(eventCharacteristicUUID, Properties::Read | Properties::Indicate)
+    };
+    const uint8_t initialValue[] = { 0, 0, 0, 0 };
+
+    constexpr UUID levelCharacteristicUUID("5C0D2E1D-7B64-4E0B-9F1D-3A2B1C0D9E8F");
+    constexpr UUID logCharacteristicUUID("5C0D2E1E-7B64-4E0B-9F1D-3A2B1C0D9E8F");
+    constexpr GattEntry queueServiceSchema[] = {
+        GattEntry::service(testServiceUUID),
+        GattEntry::characteristic(levelCharacteristicUUID, Properties::Read | Properties::Indicate),
+        GattEntry::characteristic(logCharacteristicUUID, Properties::Read | Properties::Notify)
+    };
+}
+
+static void testLittleEndian() {
+    constexpr UUID battery(0x180F);
+    static_assert(battery.littleEndian(0) == 0x0F && battery.littleEndian(1) == 0x18, "16 bit UUIDs are sent low byte first");
+
+    constexpr UUID service("00112233-4455-6677-8899-AABBCCDDEEFF");
+    for (size_t i = 0; i < 16; i++)
+        CHECK_EQUAL(0xFF - i * 0x11, service.littleEndian(i));
+}
+
+static void testEmptyValue() {
+    // no data behind an empty value, set() mustn't hand memcpy its null pointer
+    Value<4> value{Bytes()};
+    CHECK_EQUAL(0, value.get().size);
+    CHECK(value.set(Bytes(initialValue)));
+    CHECK(value.set(Bytes()));
+    CHECK_EQUAL(0, value.get().size);
+}
+
+static void testWritesDontAllocate() {
+    std::unique_ptr<Manager> manager = bluetooth(testServiceUUID);
+    std::shared_ptr<Service> service = std::make_shared<Service>(testServiceSchema);
+    std::shared_ptr<Characteristic> setting = std::make_shared<MutableCharacteristic<4>>(settingCharacteristicUUID, initialValue);
+    std::shared_ptr<Characteristic> event = std::make_shared<IndicateCharacteristic<4>>(eventCharacteristicUUID, initialValue);
+    service->addCharacteristic(setting);
+    service->addCharacteristic(event);
+    CHECK(manager->addService(service));
+
+    ble.connect();
+    uint16_t settingHandle = ble.valueHandle(settingCharacteristicUUID.data128());
+    uint16_t configurationHandle = ble.configurationHandle(eventCharacteristicUUID.data128());
+
+    // the central's buffers, built before counting
+    const std::vector<uint8_t> subscribe = { GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_INDICATION, 0 };
+    const std::vector<uint8_t> value = { 1, 2, 3 };
+    const std::vector<uint8_t> tooLong = { 1, 2, 3, 4, 5 };
+    ble.updates.reserve(8);
+    uint8_t buffer[8] = {};
+
+    uint64_t allocations = Mock::allocations();
+    CHECK_EQUAL(0, ble.write(configurationHandle, subscribe));
+    CHECK(event->isSubscribed());
+    CHECK_EQUAL(0, ble.write(settingHandle, value));
+    CHECK_EQUAL((int)ATT_ERROR_INVALID_ATTRIBUTE_VALUE_LENGTH, ble.write(settingHandle, tooLong));
+    CHECK_EQUAL(3, ble.read(settingHandle, buffer, sizeof(buffer)));
+    event->setValue(Bytes(buffer, 3));
+    manager->process();
+    CHECK_EQUAL(0u, Mock::allocations() - allocations);
+
+    CHECK_EQUAL(3, buffer[2]);
+    CHECK_EQUAL(1u, ble.updates.size());
+    CHECK(ble.updates.size() == 1 && ble.updates[0].bytes() == value);
+
+    // reads carry no offset, a short buffer gets the start of the value every time
+    uint8_t start[2] = {};
+    CHECK_EQUAL(2, ble.read(settingHandle, start, sizeof(start)));
+    CHECK_EQUAL(1, start[0]);
+    start[0] = 0;
+    CHECK_EQUAL(2, ble.read(settingHandle, start, sizeof(start)));
+    CHECK_EQUAL(1, start[0]);
+}
+
+static void testSchemaMismatch() {
+    std::unique_ptr<Manager> manager = bluetooth(testServiceUUID);
+    size_t attributes = ble.attributes.size();
+    std::shared_ptr<Characteristic> setting = std::make_shared<MutableCharacteristic<4>>(settingCharacteristicUUID, initialValue);
+    std::shared_ptr<Characteristic> event = std::make_shared<IndicateCharacteristic<4>>(eventCharacteristicUUID, initialValue);
+    std::shared_ptr<Characteristic> notifyingEvent = std::make_shared<NotifyCharacteristic<4>>(eventCharacteristicUUID, initialValue);
+
+    // a characteristic missing
+    std::shared_ptr<Service> missing = std::make_shared<Service>(testServiceSchema);
+    missing->addCharacteristic(setting);
+    CHECK(!manager->addService(missing));
+
+    // in the wrong order
+    std::shared_ptr<Service> swapped = std::make_shared<Service>(testServiceSchema);
+    swapped->addCharacteristic(event);
+    swapped->addCharacteristic(setting);
+    CHECK(!manager->addService(swapped));
+
+    // other properties than declared
+    std::shared_ptr<Service> notifying = std::make_shared<Service>(testServiceSchema);
+    notifying->addCharacteristic(setting);
+    notifying->addCharacteristic(notifyingEvent);
+    CHECK(!manager->addService(notifying));
+
+    // refused before anything reached btstack, so the handles still line up
+    CHECK_EQUAL(attributes, ble.attributes.size());
+    std::shared_ptr<Service> matching = std::make_shared<Service>(testServiceSchema);
+    matching->addCharacteristic(setting);
+    matching->addCharacteristic(event);
+    CHECK(manager->addService(matching));
+    CHECK(ble.attributes.size() > attributes);
+    CHECK(ble.valueHandle(settingCharacteristicUUID.data128()) != 0);
+}
+
+static void testUpdateQueue() {
+    std::unique_ptr<Manager> manager = bluetooth(testServiceUUID);
+    std::shared_ptr<Service> service = std::make_shared<Service>(queueServiceSchema);
+    std::shared_ptr<Characteristic> level = std::make_shared<IndicateCharacteristic<1>>(levelCharacteristicUUID, Bytes(initialValue, 1));
+    std::shared_ptr<Characteristic> log = std::make_shared<NotifyCharacteristic<1>>(logCharacteristicUUID, Bytes(initialValue, 1),
+        Properties::None, UpdatePolicy::Ordered);
+    service->addCharacteristic(level);
+    service->addCharacteristic(log);
+    CHECK(manager->addService(service));
+    uint16_t levelHandle = ble.valueHandle(levelCharacteristicUUID.data128());
+    uint16_t logHandle = ble.valueHandle(logCharacteristicUUID.data128());
+    uint16_t serviceChangedHandle = ble.valueHandle(0x2A05);
+    // nothing queued yet
+    size_t capacity = manager->availableUpdateSlots();
+
+    // the connect callback runs on btstack's thread, it leaves the service changed
+    // indication to process() instead of touching the queue
+    ble.connect();
+    CHECK_EQUAL(0, ble.write(serviceChangedHandle + 1, { GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_INDICATION, 0 }));
+    CHECK_EQUAL(0, ble.write(ble.configurationHandle(levelCharacteristicUUID.data128()), { GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_INDICATION, 0 }));
+    CHECK_EQUAL(0, ble.write(ble.configurationHandle(logCharacteristicUUID.data128()), { GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_NOTIFICATION, 0 }));
+    CHECK_EQUAL(0u, ble.updates.size());
+    manager->process();
+    CHECK_EQUAL(1u, ble.updates.size());
+    CHECK(ble.updates.size() == 1 && ble.updates[0].handle == serviceChangedHandle && ble.updates[0].indicate);
+    ble.updates.clear();
+
+    // while the ATT server is busy, a coalesced value keeps one slot with the latest value
+    // and ordered ones queue up behind it
+    ble.canSend = 0;
+    const Manager::QueueStatistics& statistics = manager->getQueueStatistics();
+    Manager::QueueStatistics before = statistics;
+    for (uint8_t i = 1; i <= 3; i++) {
+        level->setValue(Bytes(&i, 1));
+        log->setValue(Bytes(&i, 1));
+    }
+    CHECK_EQUAL(before.enqueued + 4, statistics.enqueued);
+    CHECK_EQUAL(before.coalesced + 2, statistics.coalesced);
+    CHECK_EQUAL(capacity - 4, manager->availableUpdateSlots());
+    CHECK(manager->hasPendingUpdates());
+
+    // drained in order once the server takes them
+    ble.canSend = 1;
+    manager->process();
+    CHECK(!manager->hasPendingUpdates());
+    CHECK_EQUAL(before.sent + 4, statistics.sent);
+    const uint16_t handles[] = { levelHandle, logHandle, logHandle, logHandle };
+    const uint8_t values[] = { 3, 1, 2, 3 };
+    CHECK_EQUAL(4u, ble.updates.size());
+    for (size_t i = 0; i < 4 && i < ble.updates.size(); i++) {
+        CHECK_EQUAL(handles[i], ble.updates[i].handle);
+        CHECK_EQUAL(values[i], ble.updates[i].data[0]);
+        CHECK_EQUAL(handles[i] == levelHandle, ble.updates[i].indicate);
+    }
+    ble.updates.clear();
+
+    // a full queue drops and counts what doesn't fit, the queued ones still go out
+    ble.canSend = 0;
+    before = statistics;
+    for (uint8_t i = 0; i < capacity + 4; i++)
+        log->setValue(Bytes(&i, 1));
+    CHECK_EQUAL(0u, manager->availableUpdateSlots());
+    CHECK_EQUAL(before.dropped + 4, statistics.dropped);
+    CHECK_EQUAL(capacity, statistics.highWaterMark);
+    ble.canSend = 1;
+    manager->process();
+    CHECK_EQUAL(capacity, ble.updates.size());
+    for (size_t i = 0; i < ble.updates.size(); i++)
+        CHECK_EQUAL(i, ble.updates[i].data[0]);
+    ble.updates.clear();
+    ble.disconnect();
+}
+
+static void checkRequest(const Mock::ParameterRequest& request, uint16_t minInterval, uint16_t maxInterval, uint16_t latency) {
+    CHECK_EQUAL(BTStackClass::CONNECTION_HANDLE, request.handle);
+    CHECK_EQUAL(minInterval, request.minInterval);
+    CHECK_EQUAL(maxInterval, request.maxInterval);
+    CHECK_EQUAL(latency, request.latency);
+    CHECK_EQUAL(400, request.timeout);
+}
+
+static void testConnectionParameters() {
+    std::unique_ptr<Manager> manager = bluetooth(testServiceUUID);
+    const Manager::ConnectionStatistics& statistics = manager->getConnectionStatistics();
+    std::vector<Mock::ParameterRequest>& requests = Mock::parameterRequests();
+    requests.clear();
+    // clear of the rate limit from the manager's start
+    Mock::advanceMillis(1000);
+
+    // a fresh connection is about to be used
+    ble.connect();
+    manager->process();
+    CHECK_EQUAL(1u, requests.size());
+    if (requests.size() == 1)
+        checkRequest(requests[0], 12, 24, 0);
+    CHECK(statistics.active);
+    manager->process();
+    CHECK_EQUAL(1u, requests.size());
+
+    // relaxed once nothing was sent for idleAfter
+    Mock::advanceMillis(4999);
+    manager->process();
+    CHECK_EQUAL(1u, requests.size());
+    Mock::advanceMillis(1);
+    manager->process();
+    CHECK_EQUAL(2u, requests.size());
+    if (requests.size() == 2)
+        checkRequest(requests[1], 80, 120, 4);
+    CHECK(!statistics.active);
+
+    // activity right after a request waits out the rate limit
+    manager->noteActivity();
+    manager->process();
+    CHECK_EQUAL(2u, requests.size());
+    Mock::advanceMillis(1000);
+    manager->process();
+    CHECK_EQUAL(3u, requests.size());
+    if (requests.size() == 3)
+        checkRequest(requests[2], 12, 24, 0);
+
+    // a refused request is retried after the rate limit
+    Mock::advanceMillis(5000);
+    Mock::setParameterRequestResult(1);
+    manager->process();
+    CHECK_EQUAL(4u, requests.size());
+    CHECK_EQUAL(1u, statistics.updatesRefused);
+    CHECK(statistics.active);
+    Mock::setParameterRequestResult(0);
+    manager->process();
+    CHECK_EQUAL(4u, requests.size());
+    Mock::advanceMillis(1000);
+    manager->process();
+    CHECK_EQUAL(5u, requests.size());
+    if (requests.size() == 5)
+        checkRequest(requests[4], 80, 120, 4);
+    CHECK(!statistics.active);
+
+    // nothing more while disconnected
+    ble.disconnect();
+    Mock::advanceMillis(1000);
+    manager->noteActivity();
+    manager->process();
+    CHECK_EQUAL(5u, requests.size());
+}
+
+static void testDeviceName() {
+    // cut short to fit, not left empty
+    GapService gap("Boost steering wheel adapter");
+    Bytes name = gap.getCharacteristics()[0]->getValue();
+    CHECK_EQUAL(GapService::MAX_DEVICE_NAME_LENGTH, name.size);
+    CHECK(memcmp(name.data, "Boost steering wheel", name.size) == 0);
+}
+
+int main() {
+    Serial.capture = false;
+    testLittleEndian();
+    testEmptyValue();
+    testWritesDontAllocate();
+    testSchemaMismatch();
+    testUpdateQueue();
+    testConnectionParameters();
+    testDeviceName();
+    return checkResult();
+}
@@ -0,0 +1,134 @@
+#include "Check.h"
+#include "Mock.h"
+#include "BatteryManager.h"
+#include "carloop.h"
+
+#include <cmath>
+
+// BatteryManager's filter on scripted ADC bursts: outliers trimmed off each
+// burst, nothing acted on before the filter settles, and how fast it follows a step.
+
+namespace {
+    const size_t burstSize = 9;
+    // the filter's weight per burst
+    const float filterWeight = 0.25f;
+    const uint32_t settleBursts = 8;
+    const uint32_t windowBursts = 4;
+
+    // 12.5 V, parked with the engine off
+    const int32_t vehicleOff = 2800;
+    // 14.2 V, alternator charging
+    const int32_t vehicleRunning = 3180;
+
+    float volts(float adcValue) {
+        return adcValue * 3.3f / 4096 * CarloopRevision2::BATTERY_FACTOR;
+    }
+
+    bool near(float expected, float actual) {
+        return std::fabs(expected - actual) < 0.001f;
+    }
+
+    // each burst: a little noise around level, two starter dips and two
+    // injector spikes, moved around so they land anywhere in the burst
+    void noisyBursts(const int32_t& level) {
+        static const int32_t offsets[burstSize] = { -2, -1, 0, 1, 2 };
+        static const bool outliers[burstSize] = { false, false, false, false, false, true, true, true, true };
+        size_t next = 0;
+        Mock::setAnalogRead([&level, next](uint16_t pin) mutable -> int32_t {
+            CHECK_EQUAL(CarloopRevision2::BATTERY_PIN, pin);
+            // shifted by one each burst
+            size_t i = (next + next / burstSize) % burstSize;
+            next++;
+            if (!outliers[i])
+                return level + offsets[i];
+            return i % 2 ? 0 : 4095;
+        });
+    }
+}
+
+static void testOutliers() {
+    int32_t level = vehicleRunning;
+    noisyBursts(level);
+    BatteryManager battery;
+    uint32_t sleeps = Mock::sleeps();
+
+    // the trimmed mean and extremes only see the samples around the level
+    battery.sample();
+    const BatteryManager::Reading& reading = battery.getReading();
+    CHECK(near(volts(level), reading.voltage));
+    CHECK(near(volts(level - 2), reading.minimum));
+    CHECK(near(volts(level + 2), reading.maximum));
+    CHECK(near(volts(level + 2) - volts(level - 2), reading.ripple));
+
+    // and the dips never make a running car look parked
+    for (uint32_t i = 0; i < 4 * settleBursts; i++) {
+        battery.sample();
+        battery.sleepIfLowBattery();
+        CHECK(near(volts(level), reading.voltage));
+    }
+    CHECK_EQUAL(sleeps, Mock::sleeps());
+    Mock::setAnalogRead(nullptr);
+}
+
+static void testSettling() {
+    int32_t level = vehicleOff;
+    noisyBursts(level);
+    BatteryManager battery;
+    uint32_t sleeps = Mock::sleeps();
+
+    // the reading is there from the first burst, but not acted on
+    for (uint32_t i = 1; i < settleBursts; i++) {
+        battery.sample();
+        battery.sleepIfLowBattery();
+        CHECK(!battery.isSettled());
+        CHECK(near(volts(level), battery.getReading().voltage));
+    }
+    CHECK_EQUAL(sleeps, Mock::sleeps());
+
+    battery.sample();
+    CHECK(battery.isSettled());
+    battery.sleepIfLowBattery();
+    CHECK_EQUAL(sleeps + 1, Mock::sleeps());
+    Mock::setAnalogRead(nullptr);
+}
+
+static void testConvergence() {
+    int32_t level = vehicleOff;
+    noisyBursts(level);
+    BatteryManager battery;
+    const BatteryManager::Reading& reading = battery.getReading();
+    battery.sample();
+    CHECK(near(volts(vehicleOff), reading.voltage));
+
+    // the engine starts: each burst closes a quarter of the remaining gap
+    level = vehicleRunning;
+    float gap = volts(vehicleOff) - volts(vehicleRunning);
+    for (uint32_t burst = 1; burst <= 16; burst++) {
+        battery.sample();
+        float expected = volts(vehicleRunning) + gap * std::pow(1 - filterWeight, burst);
+        CHECK(near(expected, reading.voltage));
+        // never overshoots
+        CHECK(reading.voltage > volts(vehicleOff) && reading.voltage < volts(vehicleRunning));
+
+        // the extremes follow the window, not the filter. the first one spans the step
+        if (burst + 1 == windowBursts) {
+            CHECK(near(volts(vehicleOff - 2), reading.minimum));
+            CHECK(near(volts(vehicleRunning + 2), reading.maximum));
+        }
+        if (burst + 1 == 2 * windowBursts) {
+            CHECK(near(volts(vehicleRunning - 2), reading.minimum));
+            CHECK(near(volts(vehicleRunning + 2), reading.maximum));
+        }
+        // within 5% after 11 bursts, under three seconds of SAMPLE_INTERVAL
+        if (burst == 11)
+            CHECK(std::fabs(reading.voltage - volts(vehicleRunning)) < 0.05f * std::fabs(gap));
+    }
+    Mock::setAnalogRead(nullptr);
+}
+
+int main() {
+    testOutliers();
+    testSettling();
+    testConvergence();
+    return checkResult();
+}
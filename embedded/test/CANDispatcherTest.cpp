@@ -0,0 +1,198 @@
+#include "Check.h"
+#include "CANDispatcher.h"
+
+#include <set>
+
+// Checks the acceptance filters computeFilters() derives from the registered
+// handlers: every registered id gets through, nothing else does, and exact
+// sets use the fewest filter banks.
+
+static void ignore(const CANFrame& frame) {}
+
+static bool accepted(const CANDispatcher::Filter* filters, size_t count, uint32_t id, bool extended) {
+    for (size_t i = 0; i < count; i++) {
+        const CANDispatcher::Filter& filter = filters[i];
+        if (filter.extended == extended && (id & filter.mask) == (filter.id & filter.mask))
+            return true;
+    }
+    return false;
+}
+
+// every standard id is checked, extended ids around the registered ones
+static void checkExactly(const CANDispatcher& dispatcher, const std::set<uint32_t>& standard,
+                         const std::set<uint32_t>& extended, size_t expectedFilters) {
+    CANDispatcher::Filter filters[CANDispatcher::MAX_FILTERS];
+    size_t count = dispatcher.computeFilters(filters, CANDispatcher::MAX_FILTERS);
+    CHECK_EQUAL(expectedFilters, count);
+
+    for (uint32_t id = 0; id <= 0x7FF; id++) {
+        CHECK_EQUAL(standard.count(id) > 0, accepted(filters, count, id, false));
+        if (extended.empty())
+            CHECK(!accepted(filters, count, id, true));
+    }
+    for (uint32_t registered : extended) {
+        for (uint32_t id = registered - 64; id != registered + 64; id++) {
+            CHECK_EQUAL(extended.count(id) > 0, accepted(filters, count, id, true));
+        }
+    }
+}
+
+static void testSingleId() {
+    CANDispatcher dispatcher;
+    dispatcher.on(0x290, ignore);
+
+    CANDispatcher::Filter filters[CANDispatcher::MAX_FILTERS];
+    CHECK_EQUAL(1u, dispatcher.computeFilters(filters, CANDispatcher::MAX_FILTERS));
+    CHECK_EQUAL(0x290u, filters[0].id);
+    CHECK_EQUAL(0x7FFu, filters[0].mask);
+    CHECK(!filters[0].extended);
+
+    checkExactly(dispatcher, { 0x290 }, {}, 1);
+}
+
+static void testAlignedRangeCollapses() {
+    CANDispatcher dispatcher;
+    std::set<uint32_t> ids;
+    for (uint32_t id = 0x100; id < 0x110; id++) {
+        dispatcher.on(id, ignore);
+        ids.insert(id);
+    }
+    checkExactly(dispatcher, ids, {}, 1);
+}
+
+static void testUnalignedRange() {
+    // 0x100-0x103 and 0x104-0x105
+    CANDispatcher dispatcher;
+    std::set<uint32_t> ids;
+    for (uint32_t id = 0x100; id < 0x106; id++) {
+        dispatcher.on(id, ignore);
+        ids.insert(id);
+    }
+    checkExactly(dispatcher, ids, {}, 2);
+}
+
+static void testUnrelatedIds() {
+    CANDispatcher dispatcher;
+    dispatcher.on(0x123, ignore);
+    dispatcher.on(0x456, ignore);
+    dispatcher.on(0x7FF, ignore);
+    checkExactly(dispatcher, { 0x123, 0x456, 0x7FF }, {}, 3);
+}
+
+static void testStandardAndExtendedNeverMerge() {
+    CANDispatcher dispatcher;
+    dispatcher.on(0x100, ignore);
+    dispatcher.on(0x100, ignore, true);
+    dispatcher.on(0x101, ignore, true);
+    checkExactly(dispatcher, { 0x100 }, { 0x100, 0x101 }, 2);
+}
+
+static void testExtendedRange() {
+    CANDispatcher dispatcher;
+    std::set<uint32_t> ids;
+    for (uint32_t id = 0x18DAF110; id < 0x18DAF118; id++) {
+        dispatcher.on(id, ignore, true);
+        ids.insert(id);
+    }
+    checkExactly(dispatcher, {}, ids, 1);
+}
+
+static void testMaskedHandlerCoversExactOnes() {
+    CANDispatcher dispatcher;
+    dispatcher.on(0x200, 0x700, ignore);
+    dispatcher.on(0x210, ignore);
+    dispatcher.on(0x2FF, ignore);
+
+    std::set<uint32_t> ids;
+    for (uint32_t id = 0x200; id < 0x300; id++)
+        ids.insert(id);
+    checkExactly(dispatcher, ids, {}, 1);
+}
+
+static void testWidensWhenOutOfBanks() {
+    CANDispatcher dispatcher;
+    std::set<uint32_t> ids;
+    for (uint32_t i = 0; i < 40; i++) {
+        uint32_t id = (i * 0x135 + 0x21) & 0x7FF;
+        dispatcher.on(id, ignore);
+        ids.insert(id);
+    }
+
+    const size_t limits[] = { CANDispatcher::MAX_FILTERS, 4, 1 };
+    for (size_t limit : limits) {
+        CANDispatcher::Filter filters[CANDispatcher::MAX_FILTERS];
+        size_t count = dispatcher.computeFilters(filters, limit);
+        CHECK(count > 0 && count <= limit);
+        for (uint32_t id : ids)
+            CHECK(accepted(filters, count, id, false));
+    }
+}
+
+static void testApplyFilters() {
+    CANDispatcher dispatcher;
+    dispatcher.on(0x290, ignore);
+    dispatcher.on(0x18DAF110, ignore, true);
+
+    CANChannel can(CAN_D1_D2);
+    dispatcher.applyFilters(can);
+    can.begin(500000);
+
+    std::vector<CANChannel::Filter> programmed = can.getFilters();
+    CHECK_EQUAL(2u, programmed.size());
+
+    CANMessage message;
+    message.id = 0x290;
+    CHECK(can.inject(message));
+    message.id = 0x291;
+    CHECK(!can.inject(message));
+    message.id = 0x18DAF110;
+    message.extended = true;
+    CHECK(can.inject(message));
+    message.id = 0x290;
+    CHECK(!can.inject(message));
+    CHECK_EQUAL(2u, can.filtered);
+}
+
+static uint32_t lastHandled;
+static int handledCount;
+static void record(const CANFrame& frame) {
+    lastHandled = frame.message.id;
+    handledCount++;
+}
+
+static void testDispatch() {
+    CANDispatcher dispatcher;
+    CHECK(dispatcher.on(0x290, record));
+    CHECK(!dispatcher.on(0x290, record));
+    CHECK(!dispatcher.on(0x291, nullptr));
+    CHECK(dispatcher.on(0x300, 0x7F0, record));
+
+    CANFrame frame = {};
+    frame.message.id = 0x290;
+    CHECK(dispatcher.dispatch(frame));
+    CHECK_EQUAL(0x290u, lastHandled);
+
+    frame.message.id = 0x30A;
+    CHECK(dispatcher.dispatch(frame));
+    CHECK_EQUAL(0x30Au, lastHandled);
+
+    // same number, but extended
+    frame.message.id = 0x290;
+    frame.message.extended = true;
+    CHECK(!dispatcher.dispatch(frame));
+    CHECK_EQUAL(2, handledCount);
+}
+
+int main() {
+    testSingleId();
+    testAlignedRangeCollapses();
+    testUnalignedRange();
+    testUnrelatedIds();
+    testStandardAndExtendedNeverMerge();
+    testExtendedRange();
+    testMaskedHandlerCoversExactOnes();
+    testWidensWhenOutOfBanks();
+    testApplyFilters();
+    testDispatch();
+    return checkResult();
+}
@@ -0,0 +1,213 @@
+#include "Check.h"
+#include "Mock.h"
+#include "BLE.h"
+#include "CANReceiver.h"
+#include <thread>
+
+// The CAN stream characteristic, through the firmware's own tasks: which frames
+// reach it, how they are packed into notifications, when a partial one goes out
+// and the queue slots it leaves to button presses.
+
+namespace {
+    constexpr BLE::UUID steeringWheelCharacteristicUUID("BBBEF1D2-E1E6-4189-BE0B-C00D6D3CC6BB");
+    constexpr BLE::UUID canStreamCharacteristicUUID("2CBF8759-DF12-4B1C-9D32-B9C1C8E87CDC");
+    const uint32_t steeringWheelId = 0x290;
+    const uint32_t powerModeId = 0x1F1;
+    // the stream's, see CANStreamCharacteristic
+    const size_t packetCapacity = BLE::Manager::MAX_UPDATE_LENGTH;
+    const system_tick_t flushInterval = 20;
+    const size_t reservedUpdateSlots = 4;
+
+    CANMessage message(uint32_t id, uint8_t button) {
+        CANMessage message;
+        message.id = id;
+        message.len = 4;
+        message.data[3] = button;
+        return message;
+    }
+
+    struct Decoded {
+        uint32_t id;
+        bool extended;
+        uint8_t len;
+        uint8_t data[8];
+        // bytes it took in the notification
+        size_t length;
+    };
+
+    struct Packet {
+        uint8_t sequence;
+        size_t length;
+        std::vector<Decoded> frames;
+    };
+
+    // undoes the packing, independently of the firmware's encoder
+    Packet decode(const BTStackClass::Update& update) {
+        Packet packet = {};
+        packet.sequence = update.data[0];
+        packet.length = update.size;
+        size_t i = 1;
+        while (i < update.size) {
+            Decoded frame = {};
+            size_t start = i;
+            uint8_t flags = update.data[i++];
+            frame.extended = flags & 0x80;
+            frame.len = flags & 0x0f;
+            for (int j = 0; j < (frame.extended ? 4 : 2); j++)
+                frame.id |= (uint32_t)update.data[i++] << (j * 8);
+            while (update.data[i++] & 0x80)
+                ;
+            if (!(flags & 0x40)) {
+                for (uint8_t j = 0; j < frame.len; j++)
+                    frame.data[j] = update.data[i++];
+            }
+            frame.length = i - start;
+            packet.frames.push_back(frame);
+        }
+        CHECK_EQUAL(update.size, i);
+        return packet;
+    }
+}
+
+extern CANChannel can;
+extern CANReceiver receiver;
+extern std::unique_ptr<BLE::Manager> bluetooth;
+void processCAN();
+void processBluetooth();
+
+// through the controller and its filters to the receive thread, false if any was filtered
+static bool receive(const std::vector<CANMessage>& messages) {
+    bool accepted = true;
+    size_t expected = receiver.pending();
+    for (const CANMessage& message : messages) {
+        if (can.inject(message))
+            expected++;
+        else
+            accepted = false;
+    }
+    // the receive thread polls once the clock moves on
+    for (int i = 0; i < 100 && receiver.pending() < expected; i++) {
+        Mock::advanceMillis(1);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return accepted && receiver.pending() == expected;
+}
+
+static std::vector<Packet> streamed(size_t from) {
+    uint16_t handle = ble.valueHandle(canStreamCharacteristicUUID.data128());
+    std::vector<Packet> packets;
+    for (size_t i = from; i < ble.updates.size(); i++) {
+        if (ble.updates[i].handle == handle)
+            packets.push_back(decode(ble.updates[i]));
+    }
+    return packets;
+}
+
+static void testFilters() {
+    // the stream gets the dispatcher's frames, the rest of the bus stays filtered
+    CHECK(can.accepts(message(steeringWheelId, 0)));
+    CHECK(can.accepts(message(powerModeId, 0)));
+    CHECK(!can.accepts(message(0x100, 0)));
+    CHECK(!can.accepts(message(0x291, 0)));
+}
+
+static void testPacking() {
+    size_t from = ble.updates.size();
+    std::vector<CANMessage> messages;
+    for (uint8_t i = 0; i < 10; i++)
+        messages.push_back(message(steeringWheelId, i));
+    CHECK(receive(messages));
+    processCAN();
+    processBluetooth();
+
+    // full notifications went out, the last frames wait for more
+    std::vector<Packet> packets = streamed(from);
+    CHECK(!packets.empty());
+    size_t frames = 0;
+    for (size_t i = 0; i < packets.size(); i++) {
+        CHECK(packets[i].length <= packetCapacity);
+        CHECK_EQUAL((uint8_t)(packets[0].sequence + i), packets[i].sequence);
+        for (const Decoded& frame : packets[i].frames) {
+            CHECK_EQUAL(steeringWheelId, frame.id);
+            CHECK_EQUAL(4, frame.len);
+            CHECK_EQUAL(frames, frame.data[3]);
+            frames++;
+        }
+        // a notification only goes out once the next frame doesn't fit
+        if (i + 1 < packets.size())
+            CHECK(packets[i].length + packets[i + 1].frames[0].length > packetCapacity);
+    }
+    CHECK(frames < messages.size());
+
+    // the rest after FLUSH_INTERVAL, counted from the first frame in the packet
+    size_t sent = ble.updates.size();
+    Mock::advanceMillis(flushInterval - 1);
+    processBluetooth();
+    CHECK_EQUAL(sent, ble.updates.size());
+    Mock::advanceMillis(1);
+    processBluetooth();
+    packets = streamed(from);
+    for (size_t i = 0; i < packets.size(); i++)
+        CHECK_EQUAL((uint8_t)(packets[0].sequence + i), packets[i].sequence);
+    frames = 0;
+    for (const Packet& packet : packets) {
+        for (const Decoded& frame : packet.frames)
+            CHECK_EQUAL(frames++, frame.data[3]);
+    }
+    CHECK_EQUAL(messages.size(), frames);
+}
+
+static void testReservedSlots() {
+    ble.write(ble.configurationHandle(steeringWheelCharacteristicUUID.data128()),
+        { GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_INDICATION, 0 });
+    processBluetooth();
+
+    // the ATT server is busy, the stream backs up until only the reserved slots are left
+    ble.canSend = 0;
+    size_t from = ble.updates.size();
+    for (int batch = 0; batch < 8; batch++) {
+        CHECK(receive(std::vector<CANMessage>(16, message(steeringWheelId, 0))));
+        processCAN();
+        processBluetooth();
+    }
+    CHECK_EQUAL(reservedUpdateSlots, bluetooth->availableUpdateSlots());
+
+    // and a press still gets one
+    CHECK(receive({ message(steeringWheelId, 0x10) }));
+    processCAN();
+    CHECK_EQUAL(reservedUpdateSlots - 1, bluetooth->availableUpdateSlots());
+
+    ble.canSend = 1;
+    processBluetooth();
+    uint16_t steeringWheelHandle = ble.valueHandle(steeringWheelCharacteristicUUID.data128());
+    bool pressed = false;
+    for (size_t i = from; i < ble.updates.size(); i++)
+        pressed |= ble.updates[i].handle == steeringWheelHandle && ble.updates[i].data[0] == 0x10;
+    CHECK(pressed);
+
+    // frames were dropped, but every notification that was queued went out
+    std::vector<Packet> packets = streamed(from);
+    CHECK(!packets.empty());
+    for (size_t i = 0; i < packets.size(); i++)
+        CHECK_EQUAL((uint8_t)(packets[0].sequence + i), packets[i].sequence);
+}
+
+int main() {
+    Serial.capture = false;
+    setup();
+
+    // the phone connects and subscribes to the stream only
+    ble.connect();
+    ble.write(ble.configurationHandle(canStreamCharacteristicUUID.data128()),
+        { GATT_CLIENT_CHARACTERISTICS_CONFIGURATION_NOTIFICATION, 0 });
+    processCAN();
+    processBluetooth();
+
+    testFilters();
+    testPacking();
+    testReservedSlots();
+
+    fflush(stdout);
+    // the receive thread never stops, skip static destructors it could still be using
+    std::_Exit(checkResult());
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+// Assertions for the host tests. A failed check prints where it was and the
+// test carries on, main() returns checkResult() so ctest sees the failures.
+
+#include <cstdio>
+#include <string>
+#include <type_traits>
+
+inline int& checkFailures() {
+    static int failures = 0;
+    return failures;
+}
+
+inline std::string describe(const std::string& value) {
+    // control characters escaped, SLCAN replies are mostly \r and \a
+    std::string described = "\"";
+    for (unsigned char c : value) {
+        char escaped[8];
+        if (c == '\r')
+            described += "\\r";
+        else if (c == '\a')
+            described += "\\a";
+        else if (c < 0x20 || c >= 0x7f) {
+            snprintf(escaped, sizeof(escaped), "\\x%02x", c);
+            described += escaped;
+        } else
+            described += c;
+    }
+    return described + "\"";
+}
+inline std::string describe(const char* value) { return describe(std::string(value)); }
+inline std::string describe(bool value) { return value ? "true" : "false"; }
+inline std::string describe(long long value) { return std::to_string(value); }
+inline std::string describe(unsigned long long value) { return std::to_string(value); }
+inline std::string describe(double value) { return std::to_string(value); }
+
+template <typename T>
+std::string describe(const T& value) {
+    return describe(static_cast<typename std::conditional<std::is_signed<T>::value, long long, unsigned long long>::type>(value));
+}
+
+#define CHECK(condition) do { \
+    if (!(condition)) { \
+        printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+        checkFailures()++; \
+    } \
+} while (0)
+
+#define CHECK_EQUAL(expected, actual) do { \
+    auto checkExpected = (expected); \
+    auto checkActual = (actual); \
+    if (!(checkExpected == checkActual)) { \
+        printf("%s:%d: CHECK_EQUAL(%s, %s) failed: expected %s, got %s\n", __FILE__, __LINE__, #expected, #actual, \
+            describe(checkExpected).c_str(), describe(checkActual).c_str()); \
+        checkFailures()++; \
+    } \
+} while (0)
+
+inline int checkResult() {
+    if (checkFailures())
+        printf("%d checks failed\n", checkFailures());
+    else
+        printf("all checks passed\n");
+    return checkFailures() ? 1 : 0;
+}
@@ -0,0 +1,130 @@
+#include "Check.h"
+#include "Hex.h"
+
+#include <random>
+
+// Hex against a plain branching reference on random strings, most of them
+// valid hex, some with any byte at all in them.
+
+namespace {
+    int referenceDigit(char c) {
+        if (c >= '0' && c <= '9')
+            return c - '0';
+        if (c >= 'a' && c <= 'f')
+            return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F')
+            return c - 'A' + 10;
+        return -1;
+    }
+
+    bool referenceDecode(const char* in, unsigned digits, uint32_t& value) {
+        value = 0;
+        for (unsigned i = 0; i < digits; i++) {
+            int digit = referenceDigit(in[i]);
+            if (digit < 0)
+                return false;
+            value = (value << 4) | digit;
+        }
+        return true;
+    }
+
+    const char hexCharacters[] = "0123456789abcdefABCDEF";
+
+    void randomString(std::mt19937& random, char* out, size_t length) {
+        bool corrupt = random() % 4 == 0;
+        for (size_t i = 0; i < length; i++) {
+            if (corrupt && random() % length == 0)
+                out[i] = static_cast<char>(random());
+            else
+                out[i] = hexCharacters[random() % (sizeof(hexCharacters) - 1)];
+        }
+    }
+}
+
+static void testEveryCharacter() {
+    for (int c = 0; c < 256; c++) {
+        int expected = referenceDigit(static_cast<char>(c));
+        uint8_t digit = Hex::digitValue(static_cast<char>(c));
+        if (expected < 0)
+            CHECK(digit & Hex::INVALID);
+        else
+            CHECK_EQUAL(expected, digit);
+    }
+}
+
+static void testDecode() {
+    std::mt19937 random(1);
+    for (int i = 0; i < 1000000; i++) {
+        char in[8];
+        unsigned digits = 1 + random() % 8;
+        randomString(random, in, digits);
+
+        uint32_t expected = 0;
+        uint32_t value = 0;
+        bool valid = referenceDecode(in, digits, expected);
+        CHECK_EQUAL(valid, Hex::decode(in, digits, value));
+        if (valid)
+            CHECK_EQUAL(expected, value);
+    }
+}
+
+static void testDecodeBytes() {
+    std::mt19937 random(2);
+    for (int i = 0; i < 1000000; i++) {
+        char in[16];
+        size_t count = random() % 9;
+        randomString(random, in, count * 2);
+
+        bool valid = true;
+        uint8_t expected[8];
+        for (size_t j = 0; j < count; j++) {
+            uint32_t byte;
+            valid = referenceDecode(in + j * 2, 2, byte) && valid;
+            expected[j] = byte;
+        }
+
+        uint8_t out[8];
+        CHECK_EQUAL(valid, Hex::decodeBytes(in, out, count));
+        if (valid)
+            CHECK(memcmp(expected, out, count) == 0);
+    }
+}
+
+static void testEncode() {
+    std::mt19937 random(3);
+    for (int i = 0; i < 100000; i++) {
+        uint32_t value = random();
+        unsigned digits = 1 + random() % 8;
+
+        char out[9] = {};
+        CHECK(Hex::encode(out, value, digits) == out + digits);
+        char expected[16];
+        snprintf(expected, sizeof(expected), "%08x", value);
+        CHECK_EQUAL(std::string(expected + 8 - digits), std::string(out));
+
+        uint32_t decoded;
+        CHECK(Hex::decode(out, digits, decoded));
+        CHECK_EQUAL(digits == 8 ? value : value & ((1u << (digits * 4)) - 1), decoded);
+    }
+
+    uint8_t bytes[8];
+    for (int i = 0; i < 100000; i++) {
+        size_t count = random() % 9;
+        for (size_t j = 0; j < count; j++)
+            bytes[j] = random();
+
+        char out[16];
+        CHECK(Hex::encodeBytes(out, bytes, count) == out + count * 2);
+        uint8_t decoded[8];
+        CHECK(Hex::decodeBytes(out, decoded, count));
+        CHECK(memcmp(bytes, decoded, count) == 0);
+    }
+}
+
+int main() {
+    testEveryCharacter();
+    testDecode();
+    testDecodeBytes();
+    testEncode();
+    return checkResult();
+}
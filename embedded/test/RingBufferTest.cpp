@@ -0,0 +1,85 @@
+#include "Check.h"
+#include "RingBuffer.h"
+
+#include <thread>
+
+// RingBuffer on its own, then under a producer and a consumer thread racing
+// each other, which is how the CAN receive thread and loop() use it.
+
+static void testSingleThreaded() {
+    RingBuffer<uint32_t, 4> buffer;
+    uint32_t item = 0;
+
+    CHECK(buffer.empty());
+    CHECK(!buffer.pop(item));
+    CHECK(!buffer.peek(item));
+
+    for (uint32_t i = 0; i < 4; i++)
+        CHECK(buffer.push(i));
+    CHECK(!buffer.push(4));
+    CHECK_EQUAL(1u, buffer.getOverflows());
+    CHECK_EQUAL(4u, buffer.size());
+    CHECK_EQUAL(4u, buffer.getHighWaterMark());
+
+    CHECK(buffer.peek(item));
+    CHECK_EQUAL(0u, item);
+    for (uint32_t i = 0; i < 4; i++) {
+        CHECK(buffer.pop(item));
+        CHECK_EQUAL(i, item);
+    }
+    CHECK(buffer.empty());
+
+    // the counters wrap around the storage many times over
+    for (uint32_t i = 0; i < 1000; i++) {
+        CHECK(buffer.push(i));
+        CHECK(buffer.pop(item));
+        CHECK_EQUAL(i, item);
+    }
+    CHECK_EQUAL(1u, buffer.getOverflows());
+}
+
+// the consumer must see every item exactly once and in order, whole
+struct Item {
+    uint32_t sequence;
+    uint32_t check;
+};
+
+static void testProducerConsumer() {
+    const uint32_t count = 2000000;
+    static RingBuffer<Item, 16> buffer;
+
+    std::thread producer([&]() {
+        for (uint32_t i = 0; i < count; i++) {
+            Item item = { i, ~i };
+            while (!buffer.push(item))
+                std::this_thread::yield();
+        }
+    });
+
+    uint32_t expected = 0;
+    uint32_t outOfOrder = 0;
+    uint32_t torn = 0;
+    while (expected < count) {
+        Item item;
+        if (!buffer.pop(item)) {
+            std::this_thread::yield();
+            continue;
+        }
+        outOfOrder += item.sequence != expected;
+        torn += item.check != ~item.sequence;
+        expected = item.sequence + 1;
+    }
+    producer.join();
+
+    CHECK_EQUAL(0u, outOfOrder);
+    CHECK_EQUAL(0u, torn);
+    CHECK(buffer.empty());
+    CHECK(buffer.getHighWaterMark() <= buffer.capacity());
+    printf("%u items, %u overflows retried, high water mark %zu\n", count, buffer.getOverflows(), buffer.getHighWaterMark());
+}
+
+int main() {
+    testSingleThreaded();
+    testProducerConsumer();
+    return checkResult();
+}
@@ -0,0 +1,369 @@
+#include "Check.h"
+#include "Mock.h"
+#include "SLCAN.h"
+
+// SLCAN as a host's serial port sees it: command scripts with the exact reply
+// each line must get, and what reaches the controller because of them.
+
+namespace {
+    struct Adapter {
+        CANChannel can { CAN_D1_D2 };
+        USBSerial serial;
+        SLCAN slcan { can, serial };
+
+        std::string send(const std::string& input) {
+            serial.feed(input);
+            slcan.readInput(input.size());
+            return serial.takeOutput();
+        }
+    };
+
+    struct Step {
+        const char* command;
+        const char* reply;
+    };
+
+    template <size_t N>
+    void run(Adapter& adapter, const Step (&script)[N]) {
+        for (const Step& step : script) {
+            std::string reply = adapter.send(step.command);
+            CHECK_EQUAL(std::string(step.reply), reply);
+            if (reply != step.reply)
+                printf("  in reply to %s\n", describe(step.command).c_str());
+        }
+    }
+
+    CANFrame frame(uint32_t id, bool extended, std::initializer_list<uint8_t> data, uint32_t timestamp = 0) {
+        CANFrame frame = {};
+        frame.message.id = id;
+        frame.message.extended = extended;
+        frame.message.len = data.size();
+        std::copy(data.begin(), data.end(), frame.message.data);
+        frame.timestamp = timestamp;
+        frame.milliseconds = timestamp / 1000;
+        return frame;
+    }
+
+    // undoes the binary mode's framing, independently of SLCAN's encoder:
+    // empty if the stuffing or the crc is wrong
+    std::vector<uint8_t> unpack(const std::string& packet) {
+        std::vector<uint8_t> decoded;
+        if (packet.empty() || packet.back() != 0)
+            return {};
+        size_t i = 0;
+        while (i < packet.size() - 1) {
+            uint8_t code = packet[i++];
+            if (code == 0)
+                return {};
+            for (uint8_t j = 1; j < code && i < packet.size() - 1; j++)
+                decoded.push_back(packet[i++]);
+            if (code != 0xff && i < packet.size() - 1)
+                decoded.push_back(0);
+        }
+        if (decoded.size() < 2)
+            return {};
+
+        uint16_t crc = 0xffff;
+        for (size_t k = 0; k < decoded.size() - 2; k++) {
+            crc ^= decoded[k] << 8;
+            for (int bit = 0; bit < 8; bit++)
+                crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+        if (decoded[decoded.size() - 2] != (crc & 0xff) || decoded[decoded.size() - 1] != (crc >> 8))
+            return {};
+        decoded.resize(decoded.size() - 2);
+        return decoded;
+    }
+}
+
+static void testInformation() {
+    Adapter adapter;
+    const Step script[] = {
+        { "V\r", "V1010\r" },
+        { "N\r", "NB001\r" },
+        // hosts flush with empty lines
+        { "\r", "\r" },
+        { "\r\r\r", "\r\r\r" },
+        { "X\r", "\a" },
+        { "V1\r", "V1010\r" },
+        // status needs an open channel
+        { "F\r", "\a" },
+    };
+    run(adapter, script);
+}
+
+static void testOpenAndClose() {
+    Adapter adapter;
+    const Step script[] = {
+        { "S9\r", "\a" },
+        { "S\r", "\a" },
+        { "S66\r", "\a" },
+        { "S6\r", "\r" },
+        { "C\r", "\a" },
+        { "O\r", "\r" },
+        { "O\r", "\a" },
+        { "O1\r", "\a" },
+        // bitrate and filter only change while closed
+        { "S4\r", "\a" },
+        { "M00000000\r", "\a" },
+        { "m00000000\r", "\a" },
+        { "F\r", "F00\r" },
+    };
+    run(adapter, script);
+    CHECK(adapter.slcan.isOpen());
+    CHECK(adapter.can.isEnabled());
+    CHECK_EQUAL(500000ul, adapter.can.baud);
+
+    adapter.can.status = CAN_ERROR_PASSIVE;
+    CHECK_EQUAL(std::string("F20\r"), adapter.send("F\r"));
+    adapter.can.status = CAN_BUS_OFF;
+    CHECK_EQUAL(std::string("F80\r"), adapter.send("F\r"));
+    adapter.can.status = CAN_NO_ERROR;
+
+    CHECK_EQUAL(std::string("\r"), adapter.send("C\r"));
+    CHECK(!adapter.slcan.isOpen());
+    CHECK(!adapter.can.isEnabled());
+    CHECK_EQUAL(std::string("\a"), adapter.send("C\r"));
+}
+
+static void testDefaultBitrate() {
+    Adapter adapter;
+    CHECK_EQUAL(std::string("\r"), adapter.send("O\r"));
+    // GMLAN single wire
+    CHECK_EQUAL(33333ul, adapter.can.baud);
+}
+
+static void testSharedChannel() {
+    // the firmware already runs the channel, SLCAN only streams
+    Adapter adapter;
+    adapter.can.begin(33333);
+    const Step script[] = {
+        { "S6\r", "\a" },
+        { "O\r", "\r" },
+        { "C\r", "\r" },
+    };
+    run(adapter, script);
+    CHECK(adapter.can.isEnabled());
+    CHECK_EQUAL(33333ul, adapter.can.baud);
+}
+
+static void testTransmit() {
+    Adapter adapter;
+    const Step script[] = {
+        // closed
+        { "t1230\r", "\a" },
+        { "O\r", "\r" },
+        { "t12321122\r", "z\r" },
+        { "T1234567811A\r", "Z\r" },
+        { "r7FF8\r", "z\r" },
+        { "R1FFFFFFF0\r", "Z\r" },
+        { "t0000\r", "z\r" },
+        // id out of range
+        { "t8000\r", "\a" },
+        { "T200000000\r", "\a" },
+        // length out of range, not matching the data, or not hex
+        { "t1239\r", "\a" },
+        { "t1232112\r", "\a" },
+        { "t123211223\r", "\a" },
+        { "t12G0\r", "\a" },
+        { "t1231GG\r", "\a" },
+        // remote frames carry no data
+        { "r1231AA\r", "\a" },
+        { "t12\r", "\a" },
+        { "T1234567\r", "\a" },
+    };
+    run(adapter, script);
+
+    const std::vector<CANMessage>& sent = adapter.can.transmitted;
+    CHECK_EQUAL(5u, sent.size());
+    if (sent.size() != 5)
+        return;
+    CHECK_EQUAL(0x123u, sent[0].id);
+    CHECK(!sent[0].extended && !sent[0].rtr);
+    CHECK_EQUAL(2, sent[0].len);
+    CHECK_EQUAL(0x11, sent[0].data[0]);
+    CHECK_EQUAL(0x22, sent[0].data[1]);
+    CHECK_EQUAL(0x12345678u, sent[1].id);
+    CHECK(sent[1].extended && !sent[1].rtr);
+    CHECK_EQUAL(1, sent[1].len);
+    CHECK_EQUAL(0x1A, sent[1].data[0]);
+    CHECK_EQUAL(0x7FFu, sent[2].id);
+    CHECK(!sent[2].extended && sent[2].rtr);
+    CHECK_EQUAL(8, sent[2].len);
+    CHECK_EQUAL(0x1FFFFFFFu, sent[3].id);
+    CHECK(sent[3].extended && sent[3].rtr);
+    CHECK_EQUAL(0, sent[4].len);
+}
+
+static void testTransmitQueue() {
+    Adapter adapter;
+    adapter.send("O\r");
+
+    // the controller's mailboxes are full, frames wait in SLCAN's queue
+    adapter.can.transmitRoom = 0;
+    CHECK_EQUAL(std::string("z\r"), adapter.send("t1000\r"));
+    CHECK_EQUAL(std::string("z\r"), adapter.send("t1010\r"));
+    adapter.slcan.process();
+    CHECK_EQUAL(0u, adapter.can.transmitted.size());
+
+    adapter.can.transmitRoom = 1;
+    adapter.slcan.process();
+    CHECK_EQUAL(1u, adapter.can.transmitted.size());
+
+    // still queued when the bus goes off: acknowledged already, so a bell each
+    adapter.can.status = CAN_BUS_OFF;
+    adapter.slcan.process();
+    CHECK_EQUAL(std::string("\a"), adapter.serial.takeOutput());
+
+    adapter.can.status = CAN_NO_ERROR;
+    adapter.can.transmitRoom = 0;
+    adapter.send("t1020\r");
+    // closing drops the rest the same way
+    CHECK_EQUAL(std::string("\a\r"), adapter.send("C\r"));
+
+    SLCAN::TransmitStatistics statistics = adapter.slcan.getTransmitStatistics();
+    CHECK_EQUAL(3u, statistics.queued);
+    CHECK_EQUAL(1u, statistics.sent);
+    CHECK_EQUAL(2u, statistics.dropped);
+    CHECK_EQUAL(0u, statistics.rejected);
+}
+
+static void testLongLines() {
+    Adapter adapter;
+    const Step script[] = {
+        { "t1238112233445566778899AABBCCDDEEFF0011\r", "\a" },
+        // the next command is parsed on its own
+        { "V\r", "V1010\r" },
+    };
+    run(adapter, script);
+}
+
+static void testReadBudget() {
+    Adapter adapter;
+    adapter.serial.feed("V\rN\r");
+    adapter.slcan.readInput(2);
+    CHECK_EQUAL(std::string("V1010\r"), adapter.serial.takeOutput());
+    adapter.slcan.readInput(100);
+    CHECK_EQUAL(std::string("NB001\r"), adapter.serial.takeOutput());
+}
+
+static void testAcceptanceFilter() {
+    // SJA1000 layout: the standard id in the top 11 bits, mask bits set are don't care
+    Adapter adapter;
+    const Step script[] = {
+        { "M52000000\r", "\r" },
+        { "m001FFFFF\r", "\r" },
+        { "M5200000\r", "\a" },
+        { "O\r", "\r" },
+    };
+    run(adapter, script);
+
+    CANMessage message;
+    message.id = 0x290;
+    CHECK(adapter.can.accepts(message));
+    message.id = 0x291;
+    CHECK(!adapter.can.accepts(message));
+}
+
+static void testReceive() {
+    Adapter adapter;
+    adapter.send("O\r");
+
+    CANFrame frames[] = {
+        frame(0x290, false, { 0x00, 0x00, 0x00, 0x10 }, 1234567),
+        frame(0x1ABCDEF0, true, {}),
+        frame(0x7FF, false, { 0, 1, 2, 3, 4, 5, 6, 7 }),
+    };
+    frames[1].message.rtr = true;
+    frames[1].message.len = 2;
+    adapter.slcan.printReceivedMessages(frames, 3);
+    CHECK_EQUAL(std::string("t290400000010\r" "R1abcdef02\r" "t7ff80001020304050607\r"), adapter.serial.takeOutput());
+
+    // lawicel timestamps, milliseconds wrapping every minute
+    CHECK_EQUAL(std::string("\r"), adapter.send("Z1\r"));
+    CHECK_EQUAL(std::string("\a"), adapter.send("Z2\r"));
+    adapter.slcan.printReceivedMessage(frames[0]);
+    CHECK_EQUAL(std::string("t29040000001004d2\r"), adapter.serial.takeOutput());
+    frames[0].milliseconds = 61000;
+    adapter.slcan.printReceivedMessage(frames[0]);
+    CHECK_EQUAL(std::string("t29040000001003e8\r"), adapter.serial.takeOutput());
+    // micros() wrapping between two frames doesn't make the timestamp jump
+    frames[0].timestamp = 4294967000u;
+    frames[0].milliseconds = 4294967;
+    adapter.slcan.printReceivedMessage(frames[0]);
+    CHECK_EQUAL(std::string("t2904000000108897\r"), adapter.serial.takeOutput());
+    frames[0].timestamp += 1000;
+    frames[0].milliseconds += 1;
+    adapter.slcan.printReceivedMessage(frames[0]);
+    CHECK_EQUAL(std::string("t2904000000108898\r"), adapter.serial.takeOutput());
+}
+
+static void testReceiveOverrun() {
+    // frames that don't fit into the serial buffer are dropped, never waited for
+    Adapter adapter;
+    adapter.send("O\r");
+    adapter.serial.writeRoom = 35;
+
+    CANFrame frames[3] = {
+        frame(0x100, false, { 1 }),
+        frame(0x101, false, { 2 }),
+        frame(0x102, false, { 3 }),
+    };
+    adapter.slcan.printReceivedMessages(frames, 3);
+    CHECK_EQUAL(std::string("t100101\r"), adapter.serial.takeOutput());
+    CHECK_EQUAL(2u, adapter.slcan.getOverruns());
+}
+
+static void testBinary() {
+    Adapter adapter;
+    adapter.send("O\r");
+
+    // the switch is answered in text, everything after in packets
+    CHECK_EQUAL(std::string("\r"), adapter.send("B1\r"));
+
+    std::vector<uint8_t> reply = unpack(adapter.send("V\r"));
+    const uint8_t expectedReply[] = { 0x80, 'V', '1', '0', '1', '0', '\r' };
+    CHECK(reply == std::vector<uint8_t>(expectedReply, expectedReply + sizeof(expectedReply)));
+
+    reply = unpack(adapter.send("X\r"));
+    CHECK(reply == std::vector<uint8_t>({ 0x80, '\a' }));
+
+    // ids and zeroes in the data survive the stuffing, deltas are varints
+    uint32_t start = micros();
+    CANFrame frames[] = {
+        frame(0x290, false, { 0x00, 0x00, 0x00, 0x10 }, start + 300),
+        frame(0x12345678, true, { 0xff }, start + 300 + 1),
+    };
+    adapter.slcan.printReceivedMessages(frames, 2);
+    std::string output = adapter.serial.takeOutput();
+    size_t end = output.find('\0');
+    CHECK(end != std::string::npos);
+    if (end == std::string::npos)
+        return;
+
+    std::vector<uint8_t> first = unpack(output.substr(0, end + 1));
+    std::vector<uint8_t> second = unpack(output.substr(end + 1));
+    CHECK(first == std::vector<uint8_t>({ 0x04, 0x90, 0x02, 0xac, 0x02, 0x00, 0x00, 0x00, 0x10 }));
+    CHECK(second == std::vector<uint8_t>({ 0x41, 0x78, 0x56, 0x34, 0x12, 0x01, 0xff }));
+
+    // and switching back is answered in a packet
+    reply = unpack(adapter.send("B0\r"));
+    CHECK(reply == std::vector<uint8_t>({ 0x80, '\r' }));
+    CHECK_EQUAL(std::string("V1010\r"), adapter.send("V\r"));
+}
+
+int main() {
+    testInformation();
+    testOpenAndClose();
+    testDefaultBitrate();
+    testSharedChannel();
+    testTransmit();
+    testTransmitQueue();
+    testLongLines();
+    testReadBudget();
+    testAcceptanceFilter();
+    testReceive();
+    testReceiveOverrun();
+    testBinary();
+    return checkResult();
+}
@@ -0,0 +1,148 @@
+#include "Check.h"
+#include "Mock.h"
+#include "Scheduler.h"
+
+#include <vector>
+
+// Scheduler timelines on the simulated clock, one millisecond per pass:
+// when each task runs, across the millis() wrap, and how idle() sleeps.
+
+namespace {
+    std::vector<system_tick_t> polls, blinks, once, stalls;
+
+    void poll() { polls.push_back(millis()); }
+    void blink() { blinks.push_back(millis()); }
+    void oneShot() { once.push_back(millis()); }
+    // a task that takes far longer than it should
+    void stall() {
+        stalls.push_back(millis());
+        Mock::advanceMillis(2500);
+    }
+
+    void clear() {
+        polls.clear();
+        blinks.clear();
+        once.clear();
+        stalls.clear();
+    }
+
+    void runFor(Scheduler& scheduler, system_tick_t duration) {
+        system_tick_t start = millis();
+        while (millis() - start < duration) {
+            scheduler.run();
+            Mock::advanceMillis(1);
+        }
+    }
+}
+
+static void testTimeline() {
+    // from wherever the clock is, then again across the millis() wrap
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1)
+            Mock::advanceMillis(0x100000000ull - millis() - 1000);
+        clear();
+        system_tick_t start = millis();
+
+        Scheduler scheduler;
+        scheduler.every(0, poll);
+        scheduler.every(750, blink);
+        scheduler.after(100, oneShot);
+        runFor(scheduler, 3000);
+
+        CHECK_EQUAL(3000u, polls.size());
+        CHECK_EQUAL(1u, once.size());
+        CHECK(once.size() == 1 && once[0] - start == 100);
+        // 750, 1500 and 2250, 3000 is past the end
+        CHECK_EQUAL(3u, blinks.size());
+        for (size_t i = 0; i < blinks.size(); i++)
+            CHECK_EQUAL(750 * (i + 1), blinks[i] - start);
+    }
+}
+
+static void testTimeUntilNext() {
+    Scheduler scheduler;
+    CHECK_EQUAL(Scheduler::NO_DEADLINE, scheduler.timeUntilNext());
+    // tasks run on every pass don't set a deadline
+    scheduler.every(0, poll);
+    CHECK_EQUAL(Scheduler::NO_DEADLINE, scheduler.timeUntilNext());
+
+    scheduler.every(750, blink);
+    CHECK_EQUAL(750u, scheduler.timeUntilNext());
+    Mock::advanceMillis(700);
+    CHECK_EQUAL(50u, scheduler.timeUntilNext());
+    Mock::advanceMillis(100);
+    CHECK_EQUAL(0u, scheduler.timeUntilNext());
+}
+
+static void testOverrunSkipsInsteadOfBursting() {
+    clear();
+    Scheduler scheduler;
+    Scheduler::TaskId blinkTask = scheduler.every(750, blink);
+    scheduler.every(1000, stall);
+    runFor(scheduler, 12000);
+
+    CHECK(stalls.size() >= 3);
+    CHECK(blinks.size() >= 3);
+    for (size_t i = 1; i < blinks.size(); i++)
+        CHECK(blinks[i] - blinks[i - 1] >= 750);
+
+    scheduler.cancel(blinkTask);
+    size_t count = blinks.size();
+    runFor(scheduler, 3000);
+    CHECK_EQUAL(count, blinks.size());
+}
+
+static void testFullTable() {
+    Scheduler scheduler;
+    for (size_t i = 0; i < Scheduler::MAX_TASKS; i++)
+        CHECK_EQUAL(i, scheduler.every(10, poll));
+    CHECK_EQUAL(Scheduler::NO_TASK, scheduler.every(10, poll));
+
+    // a cancelled slot is reused
+    scheduler.cancel(3);
+    CHECK_EQUAL(3u, scheduler.after(10, oneShot));
+}
+
+static void testIdle() {
+    clear();
+    Scheduler scheduler;
+    scheduler.begin();
+    scheduler.every(0, poll);
+    scheduler.every(750, blink);
+
+    // nothing to do: sleeps right up to the blink
+    system_tick_t start = millis();
+    scheduler.idle(1000);
+    CHECK_EQUAL(750u, millis() - start);
+    scheduler.run();
+    CHECK_EQUAL(1u, blinks.size());
+
+    // never longer than asked
+    start = millis();
+    scheduler.idle(100);
+    CHECK_EQUAL(100u, millis() - start);
+
+    // a wake() from before idle() still counts, nothing may get lost in between
+    start = millis();
+    scheduler.wake();
+    scheduler.idle(1000);
+    CHECK_EQUAL(0u, millis() - start);
+
+    Scheduler::IdleStatistics statistics = scheduler.getIdleStatistics();
+    CHECK_EQUAL(1u, statistics.wakeups);
+    CHECK_EQUAL(2u, statistics.timeouts);
+    CHECK_EQUAL(850000u, statistics.blocked);
+
+    scheduler.resetIdleStatistics();
+    statistics = scheduler.getIdleStatistics();
+    CHECK_EQUAL(0u, statistics.wakeups + statistics.timeouts + statistics.blocked);
+}
+
+int main() {
+    testTimeline();
+    testTimeUntilNext();
+    testOverrunSkipsInsteadOfBursting();
+    testFullTable();
+    testIdle();
+    return checkResult();
+}
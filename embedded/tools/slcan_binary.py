@@ -0,0 +1,175 @@
+# Converts the binary SLCAN stream (B1) back into candump or Vector ASC logs.
+#
+#   python slcan_binary.py /dev/ttyACM1 > drive.log
+#   python slcan_binary.py --format asc capture.bin > drive.asc
+#
+# The port is the Duo's second USB serial port, USBSerial1, the first one only
+# carries the debug log. Reading from a serial port needs pyserial, files don't. The packet layout is
+# documented at the top of embedded/src/SLCAN.h.
+
+import argparse
+import sys
+
+packet_reply = 0x80
+packet_extended = 0x40
+packet_rtr = 0x20
+
+def crc16(data):
+    # crc-16/ccitt-false
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+def cobs_decode(data):
+    decoded = bytearray()
+    index = 0
+    while index < len(data):
+        code = data[index]
+        if code == 0 or index + code > len(data) + 1:
+            raise ValueError("bad cobs code")
+        decoded += data[index + 1:index + code]
+        index += code
+        if code != 0xFF and index < len(data):
+            decoded.append(0)
+    return bytes(decoded)
+
+def read_varint(data, index):
+    value = 0
+    shift = 0
+    while True:
+        byte = data[index]
+        index += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, index
+
+def parse_packet(packet):
+    # returns ("frame", (id, extended, rtr, delta_us, data)), ("reply", text) or None if corrupt
+    try:
+        decoded = cobs_decode(packet)
+    except ValueError:
+        return None
+    if len(decoded) < 3 or crc16(decoded[:-2]) != decoded[-2] | (decoded[-1] << 8):
+        return None
+
+    header = decoded[0]
+    body = decoded[1:-2]
+    if header & packet_reply:
+        return "reply", body.decode("ascii", "replace")
+
+    extended = bool(header & packet_extended)
+    rtr = bool(header & packet_rtr)
+    length = header & 0x0F
+    id_length = 4 if extended else 2
+    try:
+        can_id = int.from_bytes(body[:id_length], "little")
+        delta, index = read_varint(body, id_length)
+    except IndexError:
+        return None
+    data = b"" if rtr else body[index:index + length]
+    if len(data) != (0 if rtr else length):
+        return None
+    return "frame", (can_id, extended, rtr, length, delta, data)
+
+def packets(stream, until_eof):
+    # a serial port returns nothing when its read times out on a quiet bus,
+    # only a file that comes up empty has ended
+    buffer = bytearray()
+    while True:
+        chunk = stream.read(256)
+        if not chunk:
+            if until_eof:
+                return
+            continue
+        buffer += chunk
+        while True:
+            end = buffer.find(b"\x00")
+            if end < 0:
+                break
+            packet = bytes(buffer[:end])
+            del buffer[:end + 1]
+            if packet:
+                yield packet
+
+def format_candump(timestamp, interface, frame):
+    can_id, extended, rtr, length, _, data = frame
+    id_text = "%08X" % can_id if extended else "%03X" % can_id
+    payload = "R" if rtr else data.hex().upper()
+    return "(%.6f) %s %s#%s" % (timestamp, interface, id_text, payload)
+
+def format_asc(timestamp, frame):
+    can_id, extended, rtr, length, _, data = frame
+    id_text = "%Xx" % can_id if extended else "%X" % can_id
+    payload = "r" if rtr else "d %d %s" % (length, " ".join("%02X" % byte for byte in data))
+    return "%11.6f 1  %-15s Rx   %s" % (timestamp, id_text, payload)
+
+def main():
+    parser = argparse.ArgumentParser(description="decode the binary SLCAN stream")
+    parser.add_argument("source", help="serial port or captured file")
+    parser.add_argument("--format", choices=["candump", "asc"], default="candump")
+    parser.add_argument("--interface", default="can0", help="interface name in candump output")
+    parser.add_argument("--baud", type=int, default=115200)
+    arguments = parser.parse_args()
+
+    is_port = arguments.source.startswith("/dev/") or arguments.source.upper().startswith("COM")
+    if is_port:
+        import serial
+        stream = serial.Serial(arguments.source, arguments.baud, timeout=1)
+        # switch the adapter over, its reply is still text. frames only flow once it is open
+        stream.write(b"\rB1\r")
+        stream.read_until(b"\r")
+        stream.write(b"O\r")
+    else:
+        stream = open(arguments.source, "rb")
+
+    if arguments.format == "asc":
+        print("base hex  timestamps absolute")
+
+    try:
+        corrupt = convert(stream, arguments, until_eof=not is_port)
+    finally:
+        if is_port:
+            # hand the bus back to the firmware's filters, and the port back to text
+            stream.write(b"C\rB0\r")
+
+    if corrupt:
+        sys.stderr.write("%d corrupt packets skipped\n" % corrupt)
+
+def convert(stream, arguments, until_eof):
+    # prints every frame until the stream ends or ^C, returns the number of corrupt packets
+    timestamp = 0.0
+    corrupt = 0
+    try:
+        for number, packet in enumerate(packets(stream, until_eof)):
+            parsed = parse_packet(packet)
+            if parsed is None and number == 0:
+                # captures usually start with text replies, up to B1's. the
+                # packet after them may hold a \r too, so try each in turn
+                end = packet.find(b"\r")
+                while parsed is None and end >= 0:
+                    parsed = parse_packet(packet[end + 1:])
+                    end = packet.find(b"\r", end + 1)
+            if parsed is None:
+                corrupt += 1
+                continue
+            kind, value = parsed
+            if kind == "reply":
+                continue
+
+            timestamp += value[4] / 1000000.0
+            if arguments.format == "asc":
+                print(format_asc(timestamp, value))
+            else:
+                print(format_candump(timestamp, arguments.interface, value))
+            sys.stdout.flush()
+    except KeyboardInterrupt:
+        pass
+    return corrupt
+
+if __name__ == "__main__":
+    main()
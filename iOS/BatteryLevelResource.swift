@@ -18,7 +18,8 @@ struct BatteryLevel: GenericResourceDescription {
 
 extension Double: DataConvertible {
     init(from data: Data) throws {
-        guard data.count == 2 else {
+        // newer firmware appends the minimum and maximum
+        guard data.count >= 2 else {
             throw DataConvertibleError.invalidData
         }
         let value = (UInt16(data[1]) << 8) | UInt16(data[0])
@@ -43,7 +43,9 @@ struct SteeringWheel: GenericResourceDescription {
         }
 
         init(from data: Data) throws {
-            guard data.count == 1 else {
+            // first byte is the button, the little endian capture time in
+            // microseconds that follows is not needed yet
+            guard data.count >= 1 else {
                 throw DataConvertibleError.invalidData
             }
             self.init(rawValue: data[0])!